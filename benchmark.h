@@ -27,9 +27,48 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
 #define BENCHMARK_H
 
 #include <benchmark/benchmark.h>
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <limits>
 #include <memory>
+#include <memory_resource>
+#include <new>
+#include <numbers>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#include <linux/perf_event.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
 #include "typetostring.h"
 
+// The per-ISA variants of a benchmark executable (see add_benchmark in CMakeLists.txt) are
+// compiled with -DBENCHMARK_ISA="<isa>" and prefix the names of their benchmarks with "<isa>/".
+#ifdef BENCHMARK_ISA
+#define BENCHMARK_ISA_NAME(name) BENCHMARK_ISA "/" name
+#undef BENCHMARK
+#define BENCHMARK(...)                                                                     \
+  BENCHMARK_PRIVATE_DECLARE(_benchmark_)                                                   \
+    = ::benchmark::RegisterBenchmark(BENCHMARK_ISA_NAME(#__VA_ARGS__), &__VA_ARGS__)
+#else
+#define BENCHMARK_ISA_NAME(name) name
+#endif
+
 struct TemplateWrapper {
   std::vector<benchmark::internal::Benchmark *> benchmarks;
 
@@ -133,7 +172,7 @@ struct TemplateWrapper {
   TemplateWrapper BENCHMARK_PRIVATE_CONCAT(typeListFunc, n_, __LINE__)() {               \
     using TArg = __VA_ARGS__::at<N>;                                                     \
     constexpr auto *fptr = n_<TArg>;                                                     \
-    static std::string name = #n_"<" + typeToString<TArg>() + '>';                       \
+    static std::string name = BENCHMARK_ISA_NAME(#n_"<") + typeToString<TArg>() + '>';  \
     TemplateWrapper wrapper =                                                            \
         BENCHMARK_PRIVATE_CONCAT(typeListFunc, n_, __LINE__)<N - 1>();                   \
     wrapper.append(benchmark::RegisterBenchmark(name.c_str(), fptr));                    \
@@ -144,7 +183,7 @@ struct TemplateWrapper {
   TemplateWrapper BENCHMARK_PRIVATE_CONCAT(typeListFunc, n_, __LINE__)<0u>() {           \
     using TArg = __VA_ARGS__::at<0>;                                                     \
     constexpr auto *fptr = n_<TArg>;                                                     \
-    static std::string name = #n_"<" + typeToString<TArg>() + '>';                       \
+    static std::string name = BENCHMARK_ISA_NAME(#n_"<") + typeToString<TArg>() + '>';  \
     TemplateWrapper wrapper;                                                             \
     wrapper.append(benchmark::RegisterBenchmark(name.c_str(), fptr));                    \
     return wrapper;                                                                      \
@@ -180,28 +219,741 @@ template <has_subscript_operator T>
                              sizeof(T) / sizeof(std::declval<const T &>()[0])>
   {};
 
+///////////////////////////////////////////////////////////////////////////////
+// element_type_t<T>: the type of the elements of a vector type T, or T itself
+template <class T> struct element_type { using type = T; };
+
+template <has_subscript_operator T>
+  struct element_type<T>
+  { using type = std::remove_cvref_t<decltype(std::declval<const T &>()[0])>; };
+
+template <class T> using element_type_t = typename element_type<T>::type;
+
+///////////////////////////////////////////////////////////////////////////////
+// cache-aware sizes
+struct cache_sizes
+{
+  std::size_t l1d = 32 << 10;
+  std::size_t l2 = 1 << 20;
+  std::size_t l3 = 32 << 20;
+};
+
+// Data/unified cache sizes of cpu0 from sysfs, else from sysconf, else the defaults above.
+inline const cache_sizes&
+detected_cache_sizes()
+{
+  static const cache_sizes sizes = [] {
+    std::size_t found[4] = {};
+    for (int index = 0; index < 16; ++index)
+      {
+        const std::string dir
+          = "/sys/devices/system/cpu/cpu0/cache/index" + std::to_string(index) + '/';
+        std::ifstream level_file(dir + "level"), type_file(dir + "type"), size_file(dir + "size");
+        int level = 0;
+        std::string type, size;
+        if (not (level_file >> level and type_file >> type and size_file >> size))
+          break;
+        if (type == "Instruction" or level < 1 or level > 3)
+          continue;
+        std::size_t bytes = std::stoul(size);
+        if (size.back() == 'K')
+          bytes <<= 10;
+        else if (size.back() == 'M')
+          bytes <<= 20;
+        found[level] = bytes;
+      }
+#ifdef _SC_LEVEL1_DCACHE_SIZE
+    const long from_sysconf[4] = {0, sysconf(_SC_LEVEL1_DCACHE_SIZE),
+                                  sysconf(_SC_LEVEL2_CACHE_SIZE), sysconf(_SC_LEVEL3_CACHE_SIZE)};
+    for (int level = 1; level <= 3; ++level)
+      if (found[level] == 0 and from_sysconf[level] > 0)
+        found[level] = from_sysconf[level];
+#endif
+    cache_sizes r;
+    if (found[1])
+      r.l1d = found[1];
+    if (found[2])
+      r.l2 = found[2];
+    if (found[3])
+      r.l3 = found[3];
+    else if (found[2])
+      r.l3 = found[2];
+    return r;
+  }();
+  return sizes;
+}
+
+// Upper end of cache_range: clearly out of the last-level cache.
+inline std::size_t
+cache_sweep_max_bytes()
+{ return std::max(4 * detected_cache_sizes().l3, std::size_t(64) << 20); }
+
+// Element counts of T from `smallest` up to cache_sweep_max_bytes(): a sweep in steps of sqrt(2),
+// plus 1/2, 3/4, 9/10, 11/10, 5/4, 3/2, and 2 times the size of each cache level. Powers of two
+// are replaced by their predecessor, which avoids cache aliasing (and exercises the epilogues).
+template <typename T>
+  std::vector<long>
+  cache_range_sizes(long smallest = 1)
+  {
+    const auto& caches = detected_cache_sizes();
+    const long largest = cache_sweep_max_bytes() / sizeof(T);
+    std::vector<long> sizes;
+    for (double n = smallest; n <= largest; n *= std::numbers::sqrt2)
+      sizes.push_back(std::lround(n));
+    for (std::size_t cache : {caches.l1d, caches.l2, caches.l3})
+      for (double f : {.5, .75, .9, 1.1, 1.25, 1.5, 2.})
+        if (const long n = std::lround(cache * f / sizeof(T)); n >= smallest and n <= largest)
+          sizes.push_back(n);
+    for (long& n : sizes)
+      if (n > smallest and std::has_single_bit(std::size_t(n)))
+        --n;
+    std::ranges::sort(sizes);
+    const auto [first, last] = std::ranges::unique(sizes);
+    sizes.erase(first, last);
+    return sizes;
+  }
+
+// Registers cache_range_sizes<T>(smallest).
+template <typename T>
+  void
+  cache_range(benchmark::internal::Benchmark* b, long smallest = 1)
+  {
+    for (long n : cache_range_sizes<T>(smallest))
+      b->Args({n});
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// command line options
+// Removes the arguments starting with `prefix` from argv (so that benchmark::Initialize does not
+// see them) and passes them to `handle`, which returns false for unknown options.
+template <typename F>
+  void
+  take_options(int& argc, char** argv, std::string_view prefix, F&& handle)
+  {
+    int kept = 1;
+    for (int i = 1; i < argc; ++i)
+      {
+        const std::string_view arg = argv[i];
+        if (not arg.starts_with(prefix))
+          argv[kept++] = argv[i];
+        else if (not handle(arg))
+          {
+            std::cerr << "unknown option " << arg << '\n';
+            std::exit(1);
+          }
+      }
+    argc = kept;
+    argv[argc] = nullptr;
+  }
+
+///////////////////////////////////////////////////////////////////////////////
+// perf counters
+// Hardware counters via perf_event_open, independent of libpfm: construct a perf_scope right
+// before the timed loop and add_*_counters reports CYCLES, INSTRUCTIONS, BRANCH-MISSES,
+// L1D-MISSES, LLC-MISSES, and DTLB-MISSES per iteration. Counters that libpfm already reported
+// (--benchmark_perf_counters) are left alone. Only user-space events of the calling thread are
+// counted, i.e. not the workers of simd_thread_pool. --perf_counters=off disables the backend.
+inline bool&
+perf_counters_enabled()
+{
+  static bool enabled = true;
+  return enabled;
+}
+
+inline void
+parse_perf_options(int& argc, char** argv)
+{
+  take_options(argc, argv, "--perf_counters", [](std::string_view arg) {
+    if (arg == "--perf_counters=on")
+      perf_counters_enabled() = true;
+    else if (arg == "--perf_counters=off")
+      perf_counters_enabled() = false;
+    else
+      return false;
+    return true;
+  });
+}
+
+// The counters of perf_counters (and, if libpfm names them the same, of --benchmark_perf_counters).
+inline constexpr const char* perf_counter_names[]
+  = {"CYCLES", "INSTRUCTIONS", "BRANCH-MISSES", "L1D-MISSES", "LLC-MISSES", "DTLB-MISSES"};
+
+#ifdef __linux__
+// perf_event_attr::config of a PERF_TYPE_HW_CACHE event counting read misses.
+constexpr std::uint64_t
+perf_read_misses(std::uint64_t cache)
+{ return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16); }
+
+class perf_counters
+{
+  struct event
+  {
+    const char* name;
+    std::uint32_t type;
+    std::uint64_t config;
+  };
+
+  // The first event leads the group; the others are skipped if the PMU does not support them.
+  static constexpr event events[] = {
+    {perf_counter_names[0], PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {perf_counter_names[1], PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {perf_counter_names[2], PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {perf_counter_names[3], PERF_TYPE_HW_CACHE, perf_read_misses(PERF_COUNT_HW_CACHE_L1D)},
+    {perf_counter_names[4], PERF_TYPE_HW_CACHE, perf_read_misses(PERF_COUNT_HW_CACHE_LL)},
+    {perf_counter_names[5], PERF_TYPE_HW_CACHE, perf_read_misses(PERF_COUNT_HW_CACHE_DTLB)},
+  };
+
+  std::vector<int> _fds;
+  std::vector<const char*> _names;
+  bool _running = false;
+
+  static int
+  open_event(const event& e, int group)
+  {
+    perf_event_attr attr = {};
+    attr.size = sizeof(attr);
+    attr.type = e.type;
+    attr.config = e.config;
+    attr.disabled = group == -1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED
+                         | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group, PERF_FLAG_FD_CLOEXEC);
+  }
+
+  void
+  ioctl_group(unsigned long request) const
+  { ioctl(_fds.front(), request, PERF_IOC_FLAG_GROUP); }
+
+  // Counts scaled by time enabled / time running, in the order of _names. Empty if the group
+  // was never scheduled onto the PMU.
+  std::vector<double>
+  read_group() const
+  {
+    std::vector<std::uint64_t> buf(3 + _fds.size());
+    const auto bytes = read(_fds.front(), buf.data(), buf.size() * sizeof(std::uint64_t));
+    if (bytes != ssize_t(buf.size() * sizeof(std::uint64_t)) or buf[2] == 0)
+      return {};
+    const double scale = double(buf[1]) / double(buf[2]);
+    std::vector<double> values(_fds.size());
+    for (std::size_t i = 0; i < values.size(); ++i)
+      values[i] = buf[3 + i] * scale;
+    return values;
+  }
+
+  // An event group is scheduled all or nothing. Thus, drop the last member if the group does not
+  // fit onto the PMU anymore.
+  bool
+  schedulable() const
+  {
+    ioctl_group(PERF_EVENT_IOC_RESET);
+    ioctl_group(PERF_EVENT_IOC_ENABLE);
+    ioctl_group(PERF_EVENT_IOC_DISABLE);
+    return not read_group().empty();
+  }
+
+  perf_counters()
+  {
+    if (not perf_counters_enabled())
+      return;
+    const int leader = open_event(events[0], -1);
+    if (leader < 0)
+      {
+        static bool warned = false;
+        if (not std::exchange(warned, true))
+          std::cerr << "perf_event_open failed (see /proc/sys/kernel/perf_event_paranoid), "
+                       "no hardware counters\n";
+        return;
+      }
+    _fds.push_back(leader);
+    _names.push_back(events[0].name);
+    for (const event& e : std::span(events).subspan(1))
+      if (const int fd = open_event(e, leader); fd >= 0)
+        {
+          _fds.push_back(fd);
+          _names.push_back(e.name);
+          if (not schedulable())
+            {
+              close(fd);
+              _fds.pop_back();
+              _names.pop_back();
+            }
+        }
+  }
+
+public:
+  perf_counters(const perf_counters&) = delete;
+  perf_counters& operator=(const perf_counters&) = delete;
+
+  ~perf_counters()
+  {
+    for (int fd : _fds)
+      close(fd);
+  }
+
+  // One group per thread, opened on first use.
+  static perf_counters&
+  instance()
+  {
+    static thread_local perf_counters counters;
+    return counters;
+  }
+
+  void
+  start()
+  {
+    if (_fds.empty())
+      return;
+    ioctl_group(PERF_EVENT_IOC_RESET);
+    ioctl_group(PERF_EVENT_IOC_ENABLE);
+    _running = true;
+  }
+
+  void
+  cancel()
+  {
+    if (_running)
+      {
+        ioctl_group(PERF_EVENT_IOC_DISABLE);
+        _running = false;
+      }
+  }
+
+  // Stops counting and adds the counts (averaged over the iterations) to state.counters.
+  void
+  stop(benchmark::State& state)
+  {
+    if (not _running)
+      return;
+    cancel();
+    const auto values = read_group();
+    for (std::size_t i = 0; i < values.size(); ++i)
+      if (not state.counters.contains(_names[i]))
+        state.counters[_names[i]] = {values[i], benchmark::Counter::kAvgIterations};
+  }
+};
+#else
+class perf_counters
+{
+public:
+  static perf_counters&
+  instance()
+  {
+    static perf_counters counters;
+    return counters;
+  }
+
+  void
+  start()
+  {}
+
+  void
+  cancel()
+  {}
+
+  void
+  stop(benchmark::State&)
+  {}
+};
+#endif
+
+// Counts from construction until add_*_counters (or destruction, which discards the counts).
+struct perf_scope
+{
+  perf_scope()
+  { perf_counters::instance().start(); }
+
+  perf_scope(const perf_scope&) = delete;
+  perf_scope& operator=(const perf_scope&) = delete;
+
+  ~perf_scope()
+  { perf_counters::instance().cancel(); }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// robust measurement
+// robust_measure(state, kernel) replaces the `for (auto _ : state)` loop: it calibrates a batch
+// size (batches of at least 10 µs), runs batches until the kernel is warmed up (the median of
+// five batches stops improving), then samples batches until the 95 % confidence interval of the
+// median time per call is within --robust_ci percent (default 1) or --robust_max_time seconds
+// (default 1) are used up. Samples more than 3 (scaled) MADs off the median are rejected as
+// outliers. The benchmark time is the median (wall-clock) time per call; the counters give the
+// spread. Register such benchmarks with robust_iterations.
+//
+// --pin_cpu=N pins the benchmark thread to CPU N. simd_thread_pool workers inherit the affinity
+// of the thread that creates them, so do not pin for the parallel benchmarks.
+struct robust_options
+{
+  double ci_percent = 1;
+  double max_seconds = 1;
+  int pin_cpu = -1;
+};
+
+inline robust_options&
+robust_config()
+{
+  static robust_options options;
+  return options;
+}
+
+inline void
+parse_robust_options(int& argc, char** argv)
+{
+  auto& options = robust_config();
+  take_options(argc, argv, "--robust_", [&](std::string_view arg) {
+    if (arg.starts_with("--robust_ci="))
+      options.ci_percent = std::stod(std::string(arg.substr(12)));
+    else if (arg.starts_with("--robust_max_time="))
+      options.max_seconds = std::stod(std::string(arg.substr(18)));
+    else
+      return false;
+    return true;
+  });
+  take_options(argc, argv, "--pin_cpu", [&](std::string_view arg) {
+    if (not arg.starts_with("--pin_cpu="))
+      return false;
+    options.pin_cpu = std::stoi(std::string(arg.substr(10)));
+    return true;
+  });
+#ifdef __linux__
+  if (options.pin_cpu >= 0)
+    {
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      CPU_SET(options.pin_cpu, &cpus);
+      if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0)
+        {
+          std::cerr << "cannot pin to CPU " << options.pin_cpu << '\n';
+          std::exit(1);
+        }
+      benchmark::AddCustomContext("pinned to CPU", std::to_string(options.pin_cpu));
+    }
+#endif
+}
+
+// Registers a benchmark that uses robust_measure: a single iteration, whose (manual) time is set
+// by robust_measure.
+inline void
+robust_iterations(benchmark::internal::Benchmark* b)
+{ b->Iterations(1)->UseManualTime(); }
+
+struct robust_statistics
+{
+  double median = 0;
+  double p5 = 0;
+  double p95 = 0;
+  double ci = 0; // half width of the 95 % confidence interval of the median, relative to it
+  std::size_t outliers = 0;
+
+  explicit
+  robust_statistics(std::vector<double> samples)
+  {
+    auto median_of = [](std::span<const double> sorted) {
+      const std::size_t n = sorted.size();
+      return n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+    };
+    std::ranges::sort(samples);
+    const double m = median_of(samples);
+    std::vector<double> deviations(samples.size());
+    std::ranges::transform(samples, deviations.begin(), [&](double x) { return std::abs(x - m); });
+    std::ranges::sort(deviations);
+    // 1.4826 MAD estimates the standard deviation of normal distributed samples
+    const double limit = 3 * 1.4826 * median_of(deviations);
+    std::erase_if(samples, [&](double x) { return std::abs(x - m) > limit; });
+    outliers = deviations.size() - samples.size();
+
+    const std::size_t n = samples.size();
+    auto rank = [&](double q) { return std::min(n - 1, std::size_t(q * n)); };
+    median = median_of(samples);
+    p5 = samples[rank(.05)];
+    p95 = samples[rank(.95)];
+    // distribution-free: the median lies between these order statistics with 95 % probability
+    const double spread = .98 * std::sqrt(double(n));
+    const std::size_t lo = std::size_t(std::max(0., std::floor(n / 2. - spread)));
+    const std::size_t hi = std::min(n - 1, std::size_t(std::ceil(n / 2. + spread)));
+    ci = (samples[hi] - samples[lo]) / 2 / median;
+  }
+};
+
+template <typename F>
+  void
+  robust_measure(benchmark::State& state, F&& kernel)
+  {
+    if (state.max_iterations != 1)
+      {
+        state.SkipWithError("robust_measure needs robust_iterations");
+        for (auto _ : state)
+          {}
+        return;
+      }
+    using clock = std::chrono::steady_clock;
+    const auto& options = robust_config();
+    const auto start = clock::now();
+    auto time_batch = [&](long calls) {
+      const auto t0 = clock::now();
+      for (long i = 0; i < calls; ++i)
+        kernel();
+      return std::chrono::duration<double>(clock::now() - t0).count();
+    };
+    auto median_of_batches = [&](long calls) {
+      std::vector<double> times(5);
+      for (double& t : times)
+        t = time_batch(calls);
+      std::ranges::nth_element(times, times.begin() + 2);
+      return times[2];
+    };
+
+    long batch = 1;
+    while (time_batch(batch) < 10e-6 and batch < (1l << 30))
+      batch *= 2;
+    const auto warmup_deadline = start + std::chrono::duration<double>(options.max_seconds / 4);
+    for (double previous = median_of_batches(batch), current;
+         (current = median_of_batches(batch)) < .99 * previous and clock::now() < warmup_deadline;
+         previous = current)
+      {}
+    const double warmup_seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+    std::vector<double> samples;
+    std::optional<robust_statistics> stats;
+    const auto deadline = clock::now() + std::chrono::duration<double>(options.max_seconds);
+    perf_scope perf;
+    for (auto _ : state)
+      {
+        do
+          {
+            for (int i = 0; i < 5; ++i)
+              samples.push_back(time_batch(batch) / batch);
+            stats.emplace(samples);
+          }
+        while (samples.size() < 10000 and clock::now() < deadline
+                 and (samples.size() < 20 or 100 * stats->ci > options.ci_percent));
+        state.SetIterationTime(stats->median);
+      }
+    // the counts cover all sampled calls
+    perf_counters::instance().stop(state);
+    const double calls = double(samples.size()) * batch;
+    for (const char* name : perf_counter_names)
+      if (state.counters.contains(name))
+        state.counters[name] = state.counters[name].value / calls;
+
+    state.counters["time median / s"] = stats->median;
+    state.counters["time p5 / s"] = stats->p5;
+    state.counters["time p95 / s"] = stats->p95;
+    state.counters["CI / %"] = 100 * stats->ci;
+    state.counters["samples"] = samples.size();
+    state.counters["outliers"] = stats->outliers;
+    state.counters["warmup / s"] = warmup_seconds;
+  }
+
+// A counter for `value` per iteration per second. After robust_measure the iteration time is the
+// median, otherwise the CPU time that google benchmark divides rate counters by.
+inline benchmark::Counter
+per_second(benchmark::State& state, double value,
+           benchmark::Counter::OneK base = benchmark::Counter::kIs1000)
+{
+  if (state.counters.contains("time median / s"))
+    return {value / state.counters["time median / s"], benchmark::Counter::kDefaults, base};
+  else
+    return {value, benchmark::Counter::kIsIterationInvariantRate, base};
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// roofline
+// Reference peaks of the calling core, measured once at startup: FLOP/s of the peakflop.cpp
+// kernel and STREAM triad bandwidth (two loads and one store per element, counted as 12 Byte)
+// with the working set in L1, L2, L3, and memory. add_roofline_counters relates a benchmark to
+// these peaks. --roofline=off skips the measurement (and the counters).
+inline bool&
+roofline_enabled()
+{
+  static bool enabled = true;
+  return enabled;
+}
+
+inline void
+parse_roofline_options(int& argc, char** argv)
+{
+  take_options(argc, argv, "--roofline", [](std::string_view arg) {
+    if (arg == "--roofline=on")
+      roofline_enabled() = true;
+    else if (arg == "--roofline=off")
+      roofline_enabled() = false;
+    else
+      return false;
+    return true;
+  });
+}
+
+// The kernel of peakflop.cpp: an independent multiply-add chain per element of x.
+template <typename V, std::size_t N>
+  [[gnu::always_inline]] inline void
+  peak_flop_step(V (&x)[N])
+  {
+    // unrolled, so that the chains stay in registers
+#pragma GCC unroll 16
+    for (auto& v : x)
+      v = v * 3 + 1;
+  }
+
+struct roofline_peaks
+{
+  static constexpr const char* level_names[] = {"L1", "L2", "L3", "memory"};
+
+  double flops = 0;
+  double bandwidth[4] = {}; // Byte/s per entry of level_names
+
+  // Index into bandwidth for a working set of the given size.
+  static int
+  level(std::size_t working_set)
+  {
+    const auto& caches = detected_cache_sizes();
+    return working_set <= caches.l1d ? 0 : working_set <= caches.l2 ? 1
+                                         : working_set <= caches.l3 ? 2 : 3;
+  }
+};
+
+// Minimum wall-clock time of `repetitions` calls to `run`, in seconds.
+template <typename F>
+  double
+  best_seconds(int repetitions, F&& run)
+  {
+    double best = std::numeric_limits<double>::infinity();
+    for (int i = 0; i < repetitions; ++i)
+      {
+        const auto start = std::chrono::steady_clock::now();
+        run();
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+      }
+    return best;
+  }
+
+inline const roofline_peaks&
+roofline()
+{
+  static const roofline_peaks peaks = [] {
+    roofline_peaks r;
+    using V = stdx::native_simd<float>;
+
+    constexpr int chains = 8;
+    constexpr long steps = 1 << 22;
+    const double flop_seconds = best_seconds(5, [] {
+      V x[chains] = {};
+      benchmark::DoNotOptimize(x);
+      for (long i = 0; i < steps; ++i)
+        peak_flop_step(x);
+      benchmark::DoNotOptimize(x);
+    });
+    r.flops = 2. * chains * V::size() * steps / flop_seconds;
+
+    const auto& caches = detected_cache_sizes();
+    const std::size_t working_sets[] = {caches.l1d / 2, caches.l2 / 2, caches.l3 / 2,
+                                        cache_sweep_max_bytes()};
+    const std::size_t largest = working_sets[3] / (3 * sizeof(float)) / V::size() * V::size();
+    std::vector<float> data(3 * largest, 1.f);
+    for (int level = 0; level < 4; ++level)
+      {
+        const std::size_t n = working_sets[level] / (3 * sizeof(float)) / V::size() * V::size();
+        float* a = data.data();
+        const float* b = a + largest;
+        const float* c = b + largest;
+        // every measurement moves at least 256 MiB
+        const std::size_t passes = std::max<std::size_t>(1, (256 << 20) / working_sets[level]);
+        const double seconds = best_seconds(level == 3 ? 3 : 5, [&] {
+          for (std::size_t pass = 0; pass < passes; ++pass)
+            {
+              for (std::size_t i = 0; i < n; i += V::size())
+                {
+                  const V r = V(b + i, stdx::element_aligned)
+                                + 3.f * V(c + i, stdx::element_aligned);
+                  r.copy_to(a + i, stdx::element_aligned);
+                }
+              benchmark::ClobberMemory();
+            }
+        });
+        r.bandwidth[level] = 3. * sizeof(float) * n * passes / seconds;
+      }
+    return r;
+  }();
+  return peaks;
+}
+
+// Adds the counters "% of peak bandwidth" (for the cache level holding `working_set` bytes) if
+// bytes_per_iteration > 0, "% of peak FLOP/s" if flop_per_iteration > 0, and
+// "arithmetic intensity / (FLOP per Byte)" and "% of roofline" if both are given.
+static void
+add_roofline_counters(benchmark::State& state, std::size_t working_set,
+                      double bytes_per_iteration, double flop_per_iteration = 0)
+{
+  if (not roofline_enabled())
+    return;
+  const auto& peaks = roofline();
+  const double bandwidth = peaks.bandwidth[roofline_peaks::level(working_set)];
+  if (bytes_per_iteration > 0)
+    state.counters["% of peak bandwidth"]
+      = per_second(state, 100 * bytes_per_iteration / bandwidth);
+  if (flop_per_iteration > 0)
+    state.counters["% of peak FLOP/s"]
+      = per_second(state, 100 * flop_per_iteration / peaks.flops);
+  if (bytes_per_iteration > 0 and flop_per_iteration > 0)
+    {
+      state.counters["arithmetic intensity / (FLOP per Byte)"]
+        = flop_per_iteration / bytes_per_iteration;
+      // the roofline bounds the time per iteration from below
+      const double min_seconds = std::max(bytes_per_iteration / bandwidth,
+                                          flop_per_iteration / peaks.flops);
+      state.counters["% of roofline"] = per_second(state, 100 * min_seconds);
+    }
+}
+
+// Reports the peaks in the benchmark context.
+inline void
+add_roofline_context()
+{
+  if (not roofline_enabled())
+    return;
+  const auto& peaks = roofline();
+  benchmark::AddCustomContext("roofline peak FLOP/s", std::to_string(peaks.flops));
+  for (int level = 0; level < 4; ++level)
+    benchmark::AddCustomContext(std::string("roofline ") + roofline_peaks::level_names[level]
+                                  + " bandwidth / (Byte/s)",
+                                std::to_string(peaks.bandwidth[level]));
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // add_*_counters
+// T is the element type of the operations. The roofline peak is measured with float, thus
+// "% of peak FLOP/s" is only reported for T = float.
+template <typename T = float>
 static void
 add_flop_counters(benchmark::State &state, int flop_per_iteration)
 {
-  state.counters["FLOP"] = {static_cast<double>(flop_per_iteration),
-                            benchmark::Counter::kIsIterationInvariantRate};
+  perf_counters::instance().stop(state);
+  state.counters["FLOP"] = per_second(state, flop_per_iteration);
   if (state.counters.contains("CYCLES"))
-    state.counters["FLOP/cycle"] = {flop_per_iteration / state.counters["CYCLES"],
-                                    benchmark::Counter::kIsIterationInvariant};
+    {
+      state.counters["FLOP/cycle"] = {flop_per_iteration / state.counters["CYCLES"],
+                                      benchmark::Counter::kIsIterationInvariant};
+      // drops with AVX-512 frequency licences and thermal throttling
+      state.counters["frequency / Hz"]
+        = per_second(state, state.counters["CYCLES"] / state.iterations());
+    }
+  if constexpr (std::is_same_v<T, float>)
+    add_roofline_counters(state, 0, 0, flop_per_iteration);
 }
 
+// For T != void, the iteration reads or writes `arrays` arrays of `values` Ts.
 template <typename T = float>
   static void
-  add_throughput_counters(benchmark::State& state)
+  add_throughput_counters(benchmark::State& state, int arrays, double values)
   {
+    perf_counters::instance().stop(state);
     if constexpr (std::is_same_v<T, void>)
       {
-        const double values_per_iteration = state.range(0);
-        state.counters["throughput / (values per s)"] = {values_per_iteration,
-                                                   benchmark::Counter::kIsIterationInvariantRate,
-                                                   benchmark::Counter::kIs1024};
+        const double values_per_iteration = values;
+        state.counters["throughput / (values per s)"]
+          = per_second(state, values_per_iteration, benchmark::Counter::kIs1024);
 
         if (state.counters.contains("CYCLES"))
           {
@@ -213,10 +965,9 @@ template <typename T = float>
       }
     else
       {
-        const double bytes_per_iteration = state.range(0) * sizeof(T);
-        state.counters["throughput / (Byte/s)"] = {double(bytes_per_iteration),
-                                                   benchmark::Counter::kIsIterationInvariantRate,
-                                                   benchmark::Counter::kIs1024};
+        const double bytes_per_iteration = arrays * values * sizeof(T);
+        state.counters["throughput / (Byte/s)"]
+          = per_second(state, bytes_per_iteration, benchmark::Counter::kIs1024);
 
         if (state.counters.contains("CYCLES"))
           {
@@ -225,16 +976,198 @@ template <typename T = float>
               benchmark::Counter::kIsIterationInvariant
             };
           }
+        add_roofline_counters(state, bytes_per_iteration, bytes_per_iteration);
       }
 
     if (state.counters.contains("INSTRUCTIONS"))
       {
         state.counters["asm efficiency / (instructions per value)"] = {
-          double(state.range(0)) / state.counters["INSTRUCTIONS"],
+          values / state.counters["INSTRUCTIONS"],
           benchmark::Counter::kIsIterationInvariant | benchmark::Counter::kInvert
         };
       }
   }
 
-BENCHMARK_MAIN();
+// The usual case: state.range(0) values per array.
+template <typename T = float>
+  static void
+  add_throughput_counters(benchmark::State& state, int arrays = 1)
+  { add_throughput_counters<T>(state, arrays, state.range(0)); }
+
+///////////////////////////////////////////////////////////////////////////////
+// benchmark memory
+// --memory_pages=4k|thp|2m selects small pages, transparent huge pages (MADV_HUGEPAGE), or
+// explicit 2 MiB huge pages (MAP_HUGETLB, needs /proc/sys/vm/nr_hugepages). --memory_node=N binds
+// the memory to NUMA node N.
+struct memory_options
+{
+  enum pages_t { small_pages, transparent_huge_pages, huge_pages };
+
+  // the size of the mbind node mask in mmap_resource
+  static constexpr int max_numa_nodes = 1024;
+
+  pages_t pages = small_pages;
+  int numa_node = -1;
+};
+
+inline memory_options&
+memory_config()
+{
+  static memory_options options;
+  return options;
+}
+
+inline void
+parse_memory_options(int& argc, char** argv)
+{
+  auto& options = memory_config();
+  take_options(argc, argv, "--memory_", [&](std::string_view arg) {
+    if (arg == "--memory_pages=4k")
+      options.pages = memory_options::small_pages;
+    else if (arg == "--memory_pages=thp")
+      options.pages = memory_options::transparent_huge_pages;
+    else if (arg == "--memory_pages=2m")
+      options.pages = memory_options::huge_pages;
+    else if (arg.starts_with("--memory_node="))
+      {
+        options.numa_node = std::stoi(std::string(arg.substr(14)));
+        if (options.numa_node < 0 or options.numa_node >= memory_options::max_numa_nodes)
+          {
+            std::cerr << "--memory_node must be in [0, " << memory_options::max_numa_nodes
+                      << ")\n";
+            std::exit(1);
+          }
+      }
+    else
+      return false;
+    return true;
+  });
+  constexpr const char* page_names[] = {"4k", "thp", "2m"};
+  benchmark::AddCustomContext("memory_pages", page_names[options.pages]);
+  if (options.numa_node >= 0)
+    benchmark::AddCustomContext("memory_node", std::to_string(options.numa_node));
+}
+
+// A monotonic memory resource on an anonymous mapping of the given capacity. The mapping is
+// created on first allocation (i.e. after the command line was parsed) according to
+// memory_config(). release() makes the whole capacity available again without unmapping, so
+// that consecutive benchmarks reuse the same memory.
+class mmap_resource : public std::pmr::memory_resource
+{
+  static constexpr std::size_t huge_page_size = 2 << 20;
+
+  std::size_t _capacity;
+  void* _mapping = nullptr;
+  std::size_t _mapped = 0;
+  std::byte* _base = nullptr;
+  std::size_t _used = 0;
+
+  void
+  map()
+  {
+    const auto& options = memory_config();
+    const std::size_t size = (_capacity + huge_page_size - 1) / huge_page_size * huge_page_size;
+    if (options.pages == memory_options::huge_pages)
+      {
+        _mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (_mapping == MAP_FAILED)
+          std::cerr << "MAP_HUGETLB failed, using transparent huge pages instead\n";
+        else
+          {
+            _mapped = size;
+            _base = static_cast<std::byte*>(_mapping);
+          }
+      }
+    if (_base == nullptr)
+      {
+        // over-allocate to start on a huge page boundary, which THP needs
+        _mapped = size + huge_page_size;
+        _mapping = mmap(nullptr, _mapped, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (_mapping == MAP_FAILED)
+          {
+            _mapping = nullptr;
+            throw std::bad_alloc();
+          }
+        const auto addr = reinterpret_cast<std::uintptr_t>(_mapping);
+        _base = reinterpret_cast<std::byte*>((addr + huge_page_size - 1) / huge_page_size
+                                               * huge_page_size);
+        madvise(_base, size, options.pages == memory_options::small_pages ? MADV_NOHUGEPAGE
+                                                                           : MADV_HUGEPAGE);
+      }
+#ifdef __linux__
+    if (options.numa_node >= 0)
+      {
+        // the results would be mislabelled as node-local, thus no fallback to unbound memory
+        constexpr unsigned long bits = sizeof(unsigned long) * 8;
+        unsigned long nodemask[memory_options::max_numa_nodes / bits] = {};
+        nodemask[options.numa_node / bits] = 1ul << (options.numa_node % bits);
+        if (syscall(SYS_mbind, _base, size, MPOL_BIND, nodemask, sizeof(nodemask) * 8, 0) != 0)
+          {
+            std::cerr << "mbind to node " << options.numa_node << " failed\n";
+            std::exit(1);
+          }
+      }
+#endif
+  }
+
+  void*
+  do_allocate(std::size_t bytes, std::size_t alignment) override
+  {
+    if (_base == nullptr)
+      map();
+    const std::size_t offset = (_used + alignment - 1) / alignment * alignment;
+    if (offset + bytes > _capacity)
+      throw std::bad_alloc();
+    _used = offset + bytes;
+    return _base + offset;
+  }
+
+  void
+  do_deallocate(void*, std::size_t, std::size_t) override
+  {}
+
+  bool
+  do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+  { return this == &other; }
+
+public:
+  explicit
+  mmap_resource(std::size_t capacity)
+  : _capacity(capacity)
+  {}
+
+  mmap_resource(const mmap_resource&) = delete;
+  mmap_resource& operator=(const mmap_resource&) = delete;
+
+  ~mmap_resource()
+  {
+    if (_mapping)
+      munmap(_mapping, _mapped);
+  }
+
+  void
+  release()
+  { _used = 0; }
+};
+
+int
+main(int argc, char** argv)
+{
+  parse_memory_options(argc, argv);
+  parse_perf_options(argc, argv);
+  parse_roofline_options(argc, argv);
+  parse_robust_options(argc, argv);
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    return 1;
+  add_roofline_context();
+#ifdef BENCHMARK_ISA
+  benchmark::AddCustomContext("ISA", BENCHMARK_ISA);
+#endif
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
 #endif // BENCHMARK_H
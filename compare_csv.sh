@@ -0,0 +1,213 @@
+#!/bin/zsh
+# SPDX-License-Identifier: GPL-3.0-or-later */
+# Copyright © 2023 GSI Helmholtzzentrum fuer Schwerionenforschung GmbH
+#                  Matthias Kretz <m.kretz@gsi.de>
+
+usage() {
+  cat<<EOF
+Usage: $0 <baseline CSV> <candidate CSV>... [<options>]
+
+Compares the real_time of every benchmark (name and size) in the Google benchmark CSV files
+against the baseline and exits with status 1 if any candidate is significantly slower by more than
+the threshold.
+
+A difference is significant if
+  - both files contain several repetitions (--benchmark_repetitions=N) and Welch's t-test rejects
+    equal means at 95 %, or
+  - both files have a "CI / %" column (robust_measure) and the confidence intervals of the medians
+    do not overlap.
+Without repetitions or confidence intervals every difference above the threshold counts.
+
+The ISA prefix of the per-ISA variants ("avx2/...") is ignored, thus the <csv>.<isa> files of
+<title>-isa --isa=all give per-ISA speedup tables. Every file must contain the results of a single
+ISA variant; files mixing several are rejected.
+
+Options:
+  -t, --threshold=PERCENT  tolerated slowdown (default: 5)
+  -f, --filter=REGEX       select a subset of benchmark names
+
+EOF
+  exit 2
+}
+
+files=()
+threshold=5
+filter=".*"
+n=1
+while ((n <= $#)); do
+  case "${@[n]}" in
+    -h|--help)
+      usage
+      ;;
+    -t|--threshold)
+      ((++n))
+      threshold="${@[n]}"
+      ;;
+    --threshold=*)
+      threshold="${@[n]#--threshold=}"
+      ;;
+    -f|--filter)
+      ((++n))
+      filter="${@[n]}"
+      ;;
+    --filter=*)
+      filter="${@[n]#--filter=}"
+      ;;
+    -*)
+      echo "Unknown option '${@[n]}'"
+      exit 2
+      ;;
+    *)
+      if [[ ! -f "${@[n]}" ]]; then
+        echo "No such file '${@[n]}'"
+        exit 2
+      fi
+      files+="${@[n]}"
+      ;;
+  esac
+  ((++n))
+done
+((${#files} >= 2)) || usage
+
+awk -v threshold="$threshold" -v filter="$filter" -f - "${files[@]}" <<'EOF'
+# two-sided 95 % quantiles of Student's t distribution
+function t_quantile(df)
+{
+  if (df >= 30) return 1.96
+  split("12.71 4.303 3.182 2.776 2.571 2.447 2.365 2.306 2.262 2.228 2.201 2.179 2.160 2.145 "\
+        "2.131 2.120 2.110 2.101 2.093 2.086 2.080 2.074 2.069 2.064 2.060 2.056 2.052 2.048 2.045",
+        q, " ")
+  return q[df < 1 ? 1 : int(df)]
+}
+
+function abs(x) { return x < 0 ? -x : x }
+
+BEGIN { ns["ns"] = 1; ns["us"] = 1e3; ns["ms"] = 1e6; ns["s"] = 1e9 }
+
+FNR == 1 {
+  ++file
+  filename[file] = FILENAME
+  time_col = unit_col = ci_col = error_col = 0
+  file_isa = ""
+}
+
+/^name,/ {
+  ncols = split($0, header, ",")
+  for (i = 2; i <= ncols; ++i)
+    {
+      gsub(/"/, "", header[i])
+      if (header[i] == "real_time") time_col = i - 1
+      else if (header[i] == "time_unit") unit_col = i - 1
+      else if (header[i] == "CI / %") ci_col = i - 1
+      else if (header[i] == "error_occurred") error_col = i - 1
+    }
+  next
+}
+
+/^"/ {
+  # the name is quoted and may contain commas
+  end = index($0, "\",")
+  name = substr($0, 2, end - 2)
+  # repetitions of different ISAs must not be pooled under one name
+  isa = match(name, /^(sse4\.2|avx2|avx512)\//) ? substr(name, 1, RLENGTH - 1) : "native"
+  if (file_isa == "")
+    file_isa = isa
+  else if (isa != file_isa)
+    {
+      printf "%s mixes the ISA variants %s and %s; compare the per-ISA files instead\n",
+             FILENAME, file_isa, isa > "/dev/stderr"
+      mixed_isa = 1
+      exit 2
+    }
+  sub(/^(sse4\.2|avx2|avx512)\//, "", name)
+  split(substr($0, end + 2), field, ",")
+  if (name ~ /_(mean|median|stddev|cv)$/ || name !~ filter) next
+  if (error_col && field[error_col] == "true") next
+  t = field[time_col] * ns[field[unit_col]]
+  key = file SUBSEP name
+  if (!((key) in count))
+    {
+      count[key] = 0
+      sum[key] = sumsq[key] = 0
+      if (file == 1) order[++nnames] = name
+    }
+  ++count[key]
+  sum[key] += t
+  sumsq[key] += t * t
+  ci[key] = ci_col && field[ci_col] != "" ? field[ci_col] / 100 : -1
+}
+
+END {
+  if (mixed_isa)
+    exit 2
+  status = 0
+  for (c = 2; c <= file; ++c)
+    {
+      printf "%s vs. %s (threshold %g %%)\n", filename[1], filename[c], threshold
+      printf "%-70s %10s %14s %14s %8s  %s\n", "benchmark", "size", "baseline/ns", "candidate/ns",
+             "speedup", "verdict"
+      for (i = 1; i <= nnames; ++i)
+        {
+          name = order[i]
+          b = 1 SUBSEP name
+          k = c SUBSEP name
+          if (!((k) in count))
+            {
+              print "  missing in " filename[c] ": " name > "/dev/stderr"
+              continue
+            }
+          mb = sum[b] / count[b]
+          mc = sum[k] / count[k]
+          # Welch's t-test on the repetitions, else overlap of the confidence intervals
+          tested = 0
+          if (count[b] >= 2 && count[k] >= 2)
+            {
+              vb = (sumsq[b] - count[b] * mb * mb) / (count[b] - 1) / count[b]
+              vc = (sumsq[k] - count[k] * mc * mc) / (count[k] - 1) / count[k]
+              vb = vb < 0 ? 0 : vb
+              vc = vc < 0 ? 0 : vc
+              if (vb + vc == 0)
+                significant = mb != mc
+              else
+                {
+                  df = (vb + vc) ^ 2 / (vb ^ 2 / (count[b] - 1) + vc ^ 2 / (count[k] - 1))
+                  significant = abs(mb - mc) / sqrt(vb + vc) > t_quantile(df)
+                }
+              tested = 1
+            }
+          else if (ci[b] >= 0 && ci[k] >= 0)
+            {
+              significant = abs(mb - mc) > ci[b] * mb + ci[k] * mc
+              tested = 1
+            }
+          else
+            significant = 1
+          speedup = mb / mc
+          slowdown = 100 * (mc / mb - 1)
+          if (!significant)
+            verdict = "~"
+          else if (slowdown > threshold)
+            {
+              verdict = tested ? "REGRESSION" : "REGRESSION (untested)"
+              status = 1
+            }
+          else if (slowdown < -threshold)
+            verdict = "faster"
+          else
+            verdict = "within threshold"
+          # split "name/size/suffix" into name + suffix and size
+          size = ""
+          shown = name
+          if (match(name, /\/[0-9]+(\/|$)/))
+            {
+              size = substr(name, RSTART + 1, RLENGTH - 1)
+              sub(/\/$/, "", size)
+              shown = substr(name, 1, RSTART - 1) substr(name, RSTART + 1 + length(size))
+            }
+          printf "%-70s %10s %14.1f %14.1f %8.3f  %s\n", shown, size, mb, mc, speedup, verdict
+        }
+      print ""
+    }
+  exit status
+}
+EOF
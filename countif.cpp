@@ -11,18 +11,18 @@
 #include <algorithm>
 #include <execution>
 #include <memory_resource>
+#include <random>
 #include <ranges>
 #include <vector>
 
-//#include "simd_for_each.h"
+#include "data_generation.h"
+#include "simd_for_each.h"
 
 namespace stdx = vir::stdx;
 
 constexpr long smallest = 32;
-constexpr long largest = smallest << 17;
 
-alignas(4096) std::array<char, largest * sizeof(float) * 2> s_buffer;
-std::pmr::monotonic_buffer_resource s_memory {s_buffer.data(), s_buffer.size()};
+mmap_resource s_memory(cache_sweep_max_bytes() * 2);
 
 template <typename T = float>
 void
@@ -48,12 +48,25 @@ add_columns(benchmark::State& state)
   }
 }
 
+// +1 (counted) and -1 in the given pattern; 50/50 independent draws by default
 auto
-make_data(std::size_t n)
+make_data(std::size_t n, data_pattern pattern = {})
 {
   s_memory.release();
   std::pmr::vector<float> v(n, &s_memory);
-  std::generate(v.begin(), v.end(), [] { return std::rand() % 2 ? 1 : -1; });
+  pattern.fill(v.begin(), v.end(), 1.f, -1.f);
+  return v;
+}
+
+// uniformly distributed in (-1, 1), so that every histogram bucket gets hits
+auto
+make_histogram_data(std::size_t n)
+{
+  s_memory.release();
+  std::pmr::vector<float> v(n, &s_memory);
+  std::mt19937 gen(1);
+  std::uniform_real_distribution<float> dist(std::nextafter(-1.f, 0.f), 1.f);
+  std::ranges::generate(v, [&] { return dist(gen); });
   return v;
 }
 
@@ -65,10 +78,14 @@ template <auto ExecutionPolicy>
     if (state.range(0) != v.size())
       std::abort();
 
+    perf_scope perf;
     for (auto _ : state)
       {
         if constexpr (std::is_same_v<decltype(ExecutionPolicy), decltype(std::execution::seq)>)
           vir::fake_read(std::count_if(v.begin(), v.end(), [](auto x) { return x > 0; }));
+        else if constexpr (execution::is_simd_policy<
+                               std::remove_cvref_t<decltype(ExecutionPolicy)>>::value)
+          vir::fake_read(::count_if(ExecutionPolicy, v, [](const auto& x) { return x > 0; }));
         else
           vir::fake_read(std::count_if(ExecutionPolicy, v.begin(), v.end(),
                                        [](auto x) { return x > 0; }));
@@ -80,7 +97,9 @@ enum Variant
 {
   Aligned,
   Sorted,
-  Misaligned
+  Misaligned,
+  Patterned, // selectivity and run scale from state.range(1) and state.range(2)
+  PatternedMisaligned
 };
 
 template <auto pol, Variant var = Aligned>
@@ -93,6 +112,17 @@ template <auto pol, Variant var = Aligned>
         std::span misaligned(v.begin() + 1, v.end());
         do_benchmark<pol>(state, misaligned);
       }
+    else if constexpr (var == Patterned)
+      {
+        auto v = make_data(state.range(0), pattern_from_args(state));
+        do_benchmark<pol>(state, v);
+      }
+    else if constexpr (var == PatternedMisaligned)
+      {
+        auto v = make_data(state.range(0) + 1, pattern_from_args(state));
+        std::span misaligned(v.begin() + 1, v.end());
+        do_benchmark<pol>(state, misaligned);
+      }
     else
       {
         auto v = make_data(state.range(0));
@@ -108,14 +138,43 @@ template <auto pol, Variant var = Aligned>
   count_if_O3(benchmark::State& state)
   { count_if_O2<pol, var>(state); }
 
+// K buckets with equidistant edges in (-1, 1)
+template <auto pol, int K, Variant var = Aligned>
+  void
+  histogram_O2(benchmark::State& state)
+  {
+    auto v = make_histogram_data(state.range(0));
+    if constexpr (var == Sorted)
+      std::sort(v.begin(), v.end());
+    std::array<float, K - 1> edges;
+    for (int k = 0; k < K - 1; ++k)
+      edges[k] = -1.f + 2.f * (k + 1) / K;
+    perf_scope perf;
+    for (auto _ : state)
+      {
+        if constexpr (std::is_same_v<decltype(pol), decltype(std::execution::seq)>)
+          {
+            std::array<std::size_t, K> counts = {};
+            for (float x : v)
+              ++counts[std::ranges::upper_bound(edges, x) - edges.begin()];
+            benchmark::DoNotOptimize(counts);
+          }
+        else
+          {
+            auto counts = ::histogram(pol, v, edges);
+            benchmark::DoNotOptimize(counts);
+          }
+      }
+    add_throughput_counters<float>(state);
+  }
+
 static void
 MyRange(benchmark::internal::Benchmark* b)
-{
-  for (long i = smallest; i <= largest; i += i)
-    b->Args({i - 1});
-  for (long i = smallest; i <= largest; i += i)
-    b->Args({i});
-}
+{ cache_range<float>(b, smallest); }
+
+static void
+PatternRange(benchmark::internal::Benchmark* b)
+{ pattern_args(b, {1 << 12, 1 << 20}); }
 
 BENCHMARK(count_if_O2<std::execution::seq>)->Apply(MyRange);
 BENCHMARK(count_if_O3<std::execution::seq>)->Apply(MyRange);
@@ -135,3 +194,69 @@ BENCHMARK(count_if_O2<vir::execution::simd, Misaligned>)->Apply(MyRange);
 BENCHMARK(count_if_O2<vir::execution::simd.unroll_by<8>(), Misaligned>)->Apply(MyRange);
 BENCHMARK(count_if_O2<vir::execution::simd.prefer_aligned(), Misaligned>)->Apply(MyRange);
 BENCHMARK(count_if_O2<vir::execution::simd.prefer_aligned().unroll_by<8>(), Misaligned>)->Apply(MyRange);
+
+// software prefetch distance (in cache lines) vs. array size
+BENCHMARK(count_if_O2<execution::simd.unroll_by<4>()>)->Apply(MyRange);
+BENCHMARK(count_if_O2<execution::simd.unroll_by<4>().prefetch<2>()>)->Apply(MyRange);
+BENCHMARK(count_if_O2<execution::simd.unroll_by<4>().prefetch<4>()>)->Apply(MyRange);
+BENCHMARK(count_if_O2<execution::simd.unroll_by<4>().prefetch<8>()>)->Apply(MyRange);
+BENCHMARK(count_if_O2<execution::simd.unroll_by<4>().prefetch<16>()>)->Apply(MyRange);
+BENCHMARK(count_if_O2<execution::simd.unroll_by<4>().prefetch<32>()>)->Apply(MyRange);
+BENCHMARK(count_if_O2<execution::simd.unroll_by<4>().prefetch<64>()>)->Apply(MyRange);
+
+// vector accumulator count_if engine: unrolling, sorted and misaligned data, threads
+BENCHMARK(count_if_O2<execution::simd>)->Apply(MyRange);
+BENCHMARK(count_if_O2<execution::simd.unroll_by<8>()>)->Apply(MyRange);
+BENCHMARK(count_if_O2<execution::simd.unroll_by<4>(), Sorted>)->Apply(MyRange);
+BENCHMARK(count_if_O2<execution::simd.unroll_by<4>(), Misaligned>)->Apply(MyRange);
+BENCHMARK(count_if_O2<execution::simd.prefer_aligned().unroll_by<4>(), Misaligned>)->Apply(MyRange);
+BENCHMARK(count_if_O3<execution::simd.unroll_by<4>()>)->Apply(MyRange);
+BENCHMARK(count_if_O2<execution::simd.unroll_by<4>().parallel<2>()>)->Apply(MyRange)->UseRealTime();
+BENCHMARK(count_if_O2<execution::simd.unroll_by<4>().parallel<4>()>)->Apply(MyRange)->UseRealTime();
+BENCHMARK(count_if_O2<execution::simd.unroll_by<4>().parallel<8>()>)->Apply(MyRange)->UseRealTime();
+BENCHMARK(count_if_O2<execution::simd.unroll_by<4>().parallel<4>(), Misaligned>)->Apply(MyRange)->UseRealTime();
+
+BENCHMARK(histogram_O2<std::execution::seq, 4>)->Apply(MyRange);
+BENCHMARK(histogram_O2<std::execution::seq, 4, Sorted>)->Apply(MyRange);
+BENCHMARK(histogram_O2<std::execution::seq, 16>)->Apply(MyRange);
+BENCHMARK(histogram_O2<execution::simd, 4>)->Apply(MyRange);
+BENCHMARK(histogram_O2<execution::simd, 4, Sorted>)->Apply(MyRange);
+BENCHMARK(histogram_O2<execution::simd, 16>)->Apply(MyRange);
+BENCHMARK(histogram_O2<execution::simd.unroll_by<2>(), 4>)->Apply(MyRange);
+BENCHMARK(histogram_O2<execution::simd.parallel<4>(), 16>)->Apply(MyRange)->UseRealTime();
+
+// branchy vs. branch-free counting as the predicate outcome gets more predictable, for every
+// policy above
+BENCHMARK(count_if_O2<std::execution::seq, Patterned>)->Apply(PatternRange);
+BENCHMARK(count_if_O3<std::execution::seq, Patterned>)->Apply(PatternRange);
+BENCHMARK(count_if_O2<std::execution::unseq, Patterned>)->Apply(PatternRange);
+BENCHMARK(count_if_O3<std::execution::unseq, Patterned>)->Apply(PatternRange);
+BENCHMARK(count_if_O2<vir::execution::simd, Patterned>)->Apply(PatternRange);
+BENCHMARK(count_if_O2<vir::execution::simd.unroll_by<4>(), Patterned>)->Apply(PatternRange);
+BENCHMARK(count_if_O2<vir::execution::simd.unroll_by<8>(), Patterned>)->Apply(PatternRange);
+BENCHMARK(count_if_O2<vir::execution::simd.prefer_aligned(), Patterned>)->Apply(PatternRange);
+BENCHMARK(count_if_O2<vir::execution::simd.prefer_aligned().unroll_by<4>(), Patterned>)->Apply(PatternRange);
+BENCHMARK(count_if_O2<vir::execution::simd.prefer_aligned().unroll_by<8>(), Patterned>)->Apply(PatternRange);
+BENCHMARK(count_if_O2<vir::execution::simd, PatternedMisaligned>)->Apply(PatternRange);
+BENCHMARK(count_if_O2<vir::execution::simd.unroll_by<4>(), PatternedMisaligned>)->Apply(PatternRange);
+BENCHMARK(count_if_O2<vir::execution::simd.unroll_by<8>(), PatternedMisaligned>)->Apply(PatternRange);
+BENCHMARK(count_if_O2<vir::execution::simd.prefer_aligned(), PatternedMisaligned>)->Apply(PatternRange);
+BENCHMARK(count_if_O2<vir::execution::simd.prefer_aligned().unroll_by<4>(), PatternedMisaligned>)->Apply(PatternRange);
+BENCHMARK(count_if_O2<vir::execution::simd.prefer_aligned().unroll_by<8>(), PatternedMisaligned>)->Apply(PatternRange);
+BENCHMARK(count_if_O2<vir::execution::simd.auto_prologue().unroll_by<4>(), PatternedMisaligned>)->Apply(PatternRange);
+BENCHMARK(count_if_O2<execution::simd, Patterned>)->Apply(PatternRange);
+BENCHMARK(count_if_O2<execution::simd.unroll_by<4>(), Patterned>)->Apply(PatternRange);
+BENCHMARK(count_if_O2<execution::simd.unroll_by<8>(), Patterned>)->Apply(PatternRange);
+BENCHMARK(count_if_O2<execution::simd.unroll_by<4>().prefetch<2>(), Patterned>)->Apply(PatternRange);
+BENCHMARK(count_if_O2<execution::simd.unroll_by<4>().prefetch<4>(), Patterned>)->Apply(PatternRange);
+BENCHMARK(count_if_O2<execution::simd.unroll_by<4>().prefetch<8>(), Patterned>)->Apply(PatternRange);
+BENCHMARK(count_if_O2<execution::simd.unroll_by<4>().prefetch<16>(), Patterned>)->Apply(PatternRange);
+BENCHMARK(count_if_O2<execution::simd.unroll_by<4>().prefetch<32>(), Patterned>)->Apply(PatternRange);
+BENCHMARK(count_if_O2<execution::simd.unroll_by<4>().prefetch<64>(), Patterned>)->Apply(PatternRange);
+BENCHMARK(count_if_O3<execution::simd.unroll_by<4>(), Patterned>)->Apply(PatternRange);
+BENCHMARK(count_if_O2<execution::simd.unroll_by<4>(), PatternedMisaligned>)->Apply(PatternRange);
+BENCHMARK(count_if_O2<execution::simd.prefer_aligned().unroll_by<4>(), PatternedMisaligned>)->Apply(PatternRange);
+BENCHMARK(count_if_O2<execution::simd.unroll_by<4>().parallel<2>(), Patterned>)->Apply(PatternRange)->UseRealTime();
+BENCHMARK(count_if_O2<execution::simd.unroll_by<4>().parallel<4>(), Patterned>)->Apply(PatternRange)->UseRealTime();
+BENCHMARK(count_if_O2<execution::simd.unroll_by<4>().parallel<8>(), Patterned>)->Apply(PatternRange)->UseRealTime();
+BENCHMARK(count_if_O2<execution::simd.unroll_by<4>().parallel<4>(), PatternedMisaligned>)->Apply(PatternRange)->UseRealTime();
@@ -0,0 +1,81 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright © 2023 GSI Helmholtzzentrum fuer Schwerionenforschung GmbH
+ *                  Matthias Kretz <m.kretz@gsi.de>
+ */
+#ifndef DATA_GENERATION_H
+#define DATA_GENERATION_H
+
+#include <benchmark/benchmark.h>
+
+#include <cmath>
+#include <cstdint>
+#include <random>
+
+// Shape of a sequence of predicate outcomes (matches): a fraction `selectivity` of the elements
+// match, and runs of equal outcomes are on average `run_scale` times longer than for
+// independent draws. The sequence is a two-state Markov chain that leaves the matching state
+// with probability (1 - selectivity) / run_scale and the non-matching state with probability
+// selectivity / run_scale. run_scale = 1 yields independent draws, i.e. the least predictable
+// branches for a given selectivity; large run_scale approaches sorted data.
+struct data_pattern {
+  double selectivity = 0.5;
+  double run_scale = 1;
+
+  // Entropy rate of the outcomes in bit per element.
+  double entropy() const
+  {
+    auto h = [](double q) {
+      return q <= 0 or q >= 1 ? 0. : -q * std::log2(q) - (1 - q) * std::log2(1 - q);
+    };
+    const double p = selectivity;
+    return p * h((1 - p) / run_scale) + (1 - p) * h(p / run_scale);
+  }
+
+  // Calls f(bool match) n times with the outcomes in order. The same seed yields the same
+  // sequence.
+  template <typename F> void generate(std::size_t n, F&& f, std::uint64_t seed = 1) const
+  {
+    std::mt19937_64 gen(seed);
+    std::bernoulli_distribution leave_match((1 - selectivity) / run_scale);
+    std::bernoulli_distribution leave_miss(selectivity / run_scale);
+    bool match = std::bernoulli_distribution(selectivity)(gen);
+    for (std::size_t i = 0; i < n; ++i) {
+      f(match);
+      match = match ? not leave_match(gen) : leave_miss(gen);
+    }
+  }
+
+  // Fills [first, last) with match / miss.
+  template <typename It, typename T> void fill(It first, It last, T match, T miss) const
+  {
+    generate(std::distance(first, last), [&](bool m) { *first++ = m ? match : miss; });
+  }
+};
+
+// Reads the pattern from state.range(first) (selectivity in percent) and state.range(first + 1)
+// (run_scale) and reports it in the counters.
+inline data_pattern pattern_from_args(benchmark::State& state, int first = 1)
+{
+  const data_pattern pattern{state.range(first) / 100., double(state.range(first + 1))};
+  state.counters["selectivity"] = pattern.selectivity;
+  state.counters["run scale"] = pattern.run_scale;
+  state.counters["entropy / (bit per value)"] = pattern.entropy();
+  return pattern;
+}
+
+// Registers {size, selectivity in percent, run_scale} for every size. Selectivities of 0 % and
+// 100 % have a single run, so they are only registered once.
+inline void pattern_args(benchmark::internal::Benchmark* b, std::initializer_list<long> sizes)
+{
+  for (long size : sizes) {
+    for (long selectivity : {0, 1, 10, 50, 90, 99, 100}) {
+      for (long run_scale : {1, 16, 1024}) {
+        if (run_scale == 1 or (selectivity != 0 and selectivity != 100)) {
+          b->Args({size, selectivity, run_scale});
+        }
+      }
+    }
+  }
+}
+
+#endif // DATA_GENERATION_H
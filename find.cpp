@@ -4,10 +4,15 @@
  */
 
 #include "benchmark.h"
+#include "data_generation.h"
+#include "simd_for_each.h"
 #include <simd.h>
 #include <mask_reductions.h>
+#include <array>
+#include <atomic>
 #include <numeric>
 #include <iostream>
+#include <span>
 
 template <typename T, typename Abi>
   std::ostream& operator<<(std::ostream& s, const std::basic_simd<T, Abi>& x)
@@ -24,6 +29,7 @@ find_scalar(benchmark::State &state)
   const int N = state.range(0);
   std::vector<int> data(N);
   std::iota(data.rbegin(), data.rend(), 0);
+  perf_scope perf;
   for (auto _ : state) {
     auto it = std::ranges::find(data, 0);
     if (std::distance(data.begin(), it) != N - 1)
@@ -47,6 +53,7 @@ template <int ILP>
       x = init;
       init -= init.size();
     }
+    perf_scope perf;
     for (auto _ : state) {
       auto it = std::ranges::find_if(data, [](auto chunk) { return any_of(chunk == 0); });
       const int offset = std::distance(data.begin(), it) * V::size() + reduce_min_index(*it == 0);
@@ -67,6 +74,7 @@ chunk_view(benchmark::State& state)
   using V = std::simd<int, std::simd<int>::size * ILP>;
   std::vector<int> data(N);
   std::iota(data.rbegin(), data.rend(), 0);
+  perf_scope perf;
   for (auto _ : state) {
     auto&& chunked = data | std::views::chunk(V::size());
     auto it = std::ranges::find_if(chunked, [](V chunk) {
@@ -91,6 +99,7 @@ simd_loads(benchmark::State& state)
   using V = std::simd<int, std::simd<int>::size * ILP>;
   std::vector<int> data(N);
   std::iota(data.rbegin(), data.rend(), 0);
+  perf_scope perf;
   for (auto _ : state) {
     auto it = data.begin();
     auto end = data.end() - V::size();
@@ -110,6 +119,283 @@ simd_loads(benchmark::State& state)
   add_throughput_counters(state);
 }
 
+// memchr-style find of value in [first, last): all loads are aligned to the vector size and thus
+// never cross a page boundary. They may read before first and after last (which cannot fault),
+// but the lanes outside [first, last) are masked off, so neither a scalar prologue nor an
+// epilogue is needed. Reading outside the object is invisible to the compiler, but not to ASan.
+[[gnu::no_sanitize_address]]
+std::size_t
+find_overread(const int* first, const int* last, int value)
+{
+  using V = std::simd<int>;
+  constexpr std::uintptr_t vector_bytes = V::size() * sizeof(int);
+  static_assert(4096 % vector_bytes == 0);
+  if (first == last)
+    return 0;
+  const V iota([](int i) { return i; });
+  const int* block = reinterpret_cast<const int*>(reinterpret_cast<std::uintptr_t>(first)
+                                                    & -vector_bytes);
+  auto match = V(block) == value && iota >= int(first - block);
+  while (last - block > V::size())
+    {
+      if (any_of(match))
+        return block - first + reduce_min_index(match);
+      block += V::size();
+      match = V(block) == value;
+    }
+  match = match && iota < int(last - block);
+  return any_of(match) ? block - first + reduce_min_index(match) : last - first;
+}
+
+// vector loop with unaligned loads and a scalar epilogue, for comparison with find_overread
+std::size_t
+find_epilogue(const int* first, const int* last, int value)
+{
+  using V = std::simd<int>;
+  const int* it = first;
+  for (; last - it >= V::size(); it += V::size())
+    {
+      const auto match = V(it) == value;
+      if (any_of(match))
+        return it - first + reduce_min_index(match);
+    }
+  for (; it < last; ++it)
+    if (*it == value)
+      break;
+  return it - first;
+}
+
+std::size_t
+find_std(const int* first, const int* last, int value)
+{ return std::find(first, last, value) - first; }
+
+// N = state.range(0) ints starting state.range(1) ints after a 64-Byte boundary, the match at N-1
+template <auto find_fun>
+  void
+  find_small(benchmark::State& state)
+  {
+    const int N = state.range(0);
+    alignas(64) std::array<int, 512> buffer = {};
+    int* data = buffer.data() + state.range(1);
+    std::iota(std::make_reverse_iterator(data + N), std::make_reverse_iterator(data), 0);
+    const int* first = data;
+    perf_scope perf;
+    for (auto _ : state) {
+      asm("" : "+r"(first));
+      const std::size_t offset = find_fun(first, first + N, 0);
+      if (offset != std::size_t(N - 1))
+        {
+          std::cout << offset << " != " << N - 1 << std::endl;
+          std::abort();
+        }
+    }
+    add_throughput_counters(state);
+  }
+
+// Finds all matches one after another, as when scanning a log for every occurrence. The matches
+// follow the pattern of state.range(1) and state.range(2), so the kernels see a sequence of
+// searches whose lengths are as (un)predictable as the pattern.
+template <auto find_fun>
+  void
+  find_all(benchmark::State& state)
+  {
+    const int N = state.range(0);
+    std::vector<int> data(N);
+    pattern_from_args(state).fill(data.begin(), data.end(), 0, 1);
+    const std::size_t expected = std::ranges::count(data, 0);
+    perf_scope perf;
+    for (auto _ : state) {
+      const int* it = data.data();
+      const int* const end = it + N;
+      asm("" : "+r"(it));
+      std::size_t matches = 0;
+      while ((it += find_fun(it, end, 0)) != end)
+        {
+          ++matches;
+          ++it;
+        }
+      if (matches != expected)
+        {
+          std::cout << matches << " != " << expected << std::endl;
+          std::abort();
+        }
+    }
+    add_throughput_counters(state);
+  }
+
+constexpr std::size_t find_chunk_size = 1 << 14;
+
+// Index of the first element x of data where pred(V(x)) is true, or data.size() if there is none.
+// The data is split into chunks of find_chunk_size elements, which the threads claim in order.
+// The best index found so far is shared via an atomic. Since chunks are claimed in increasing
+// order, a thread stops as soon as its next chunk starts after that index.
+template <typename V, typename Pred>
+  std::size_t
+  parallel_find_if(std::span<const typename V::value_type> data, Pred pred, int threads)
+  {
+    const std::size_t n = data.size();
+    const std::size_t n_chunks = (n + find_chunk_size - 1) / find_chunk_size;
+    std::atomic<std::size_t> next_chunk = 0;
+    std::atomic<std::size_t> found = n;
+    auto scan = [&] {
+      for (std::size_t c = next_chunk++; c < n_chunks; c = next_chunk++)
+        {
+          std::size_t i = c * find_chunk_size;
+          if (i >= found.load(std::memory_order_relaxed))
+            return;
+          const std::size_t end = std::min(i + find_chunk_size, n);
+          std::size_t hit = end;
+          for (; i + V::size() <= end; i += V::size())
+            {
+              const auto match = pred(V(data.begin() + i));
+              if (any_of(match))
+                {
+                  hit = i + reduce_min_index(match);
+                  break;
+                }
+            }
+          for (; hit == end && i < end; ++i)
+            if (pred(V(data[i]))[0])
+              hit = i;
+          if (hit < end)
+            {
+              std::size_t best = found.load(std::memory_order_relaxed);
+              while (hit < best
+                       && !found.compare_exchange_weak(best, hit, std::memory_order_relaxed))
+                ;
+              return;
+            }
+        }
+    };
+    if (threads <= 1)
+      scan();
+    else
+      simd_thread_pool::instance().run(threads - 1, scan);
+    return found;
+  }
+
+// state.range(1): 0 = match at the start, 1 = in the middle, 2 = at the end, 3 = no match
+static std::size_t
+match_position(const benchmark::State& state)
+{
+  const std::size_t N = state.range(0);
+  switch (state.range(1))
+    {
+    case 0:
+      return 0;
+    case 1:
+      return N / 2;
+    case 2:
+      return N - 1;
+    default:
+      return N;
+    }
+}
+
+template <typename Pred>
+  void
+  bench_parallel_find(benchmark::State& state, std::span<const int> data, Pred pred, int threads)
+  {
+    using V = std::simd<int>;
+    const std::size_t expected = match_position(state);
+    perf_scope perf;
+    for (auto _ : state) {
+      const std::size_t found = parallel_find_if<V>(data, pred, threads);
+      if (found != expected)
+        {
+          std::cout << found << " != " << expected << std::endl;
+          std::abort();
+        }
+    }
+    // the values up to and including the match
+    add_throughput_counters<void>(state, 1, std::min(expected + 1, data.size()));
+  }
+
+// first occurrence of any of K needles
+template <int K, int Threads>
+  void
+  find_any_parallel(benchmark::State& state)
+  {
+    using V = std::simd<int>;
+    std::vector<int> data(state.range(0));
+    std::iota(data.begin(), data.end(), K);
+    if (const std::size_t pos = match_position(state); pos < data.size())
+      data[pos] = K - 1;
+    std::array<int, K> needles;
+    std::iota(needles.begin(), needles.end(), 0);
+    bench_parallel_find(state, data, [&](V x) {
+      auto match = x == needles[0];
+      for (int k = 1; k < K; ++k)
+        match = match || x == needles[k];
+      return match;
+    }, Threads);
+  }
+
+// first element in [-100, 0)
+template <int Threads>
+  void
+  find_range_parallel(benchmark::State& state)
+  {
+    using V = std::simd<int>;
+    std::vector<int> data(state.range(0));
+    std::iota(data.begin(), data.end(), 0);
+    if (const std::size_t pos = match_position(state); pos < data.size())
+      data[pos] = -1;
+    bench_parallel_find(state, data, [](V x) { return x >= -100 && x < 0; }, Threads);
+  }
+
+// The kernels of find_if_simd, chunk_view, simd_loads and the parallel find_if as find_fun for
+// find_all. The kernels only search whole vectors; the remaining tail goes through find_std.
+template <int ILP>
+  std::size_t
+  find_if_vectors(const int* first, const int* last, int value)
+  {
+    using V = std::simd<int, std::simd<int>::size * ILP>;
+    const std::size_t n = (last - first) / V::size();
+    const auto vectors = std::views::iota(std::size_t(0), n);
+    auto it = std::ranges::find_if(vectors, [&](std::size_t i) {
+                return any_of(V(first + i * V::size()) == value);
+              });
+    if (it == vectors.end())
+      return n * V::size() + find_std(first + n * V::size(), last, value);
+    const std::size_t offset = *it * V::size();
+    return offset + reduce_min_index(V(first + offset) == value);
+  }
+
+std::size_t
+find_chunk_view(const int* first, const int* last, int value)
+{
+  using V = std::simd<int>;
+  const std::span<const int> data(first, (last - first) / V::size() * V::size());
+  auto&& chunked = data | std::views::chunk(V::size());
+  auto it = std::ranges::find_if(chunked, [&](V chunk) { return any_of(chunk == value); });
+  if (it == chunked.end())
+    return data.size() + find_std(first + data.size(), last, value);
+  return std::distance(chunked.begin(), it) * V::size() + reduce_min_index(V(*it) == value);
+}
+
+std::size_t
+find_simd_loads(const int* first, const int* last, int value)
+{
+  using V = std::simd<int>;
+  const int* it = first;
+  for (; last - it >= V::size(); it += V::size())
+    {
+      V chunk(it);
+      if (any_of(chunk == value))
+        return it - first + reduce_min_index(V(it) == value);
+    }
+  return it - first + find_std(it, last, value);
+}
+
+template <int Threads>
+  std::size_t
+  find_parallel(const int* first, const int* last, int value)
+  {
+    using V = std::simd<int>;
+    return parallel_find_if<V>(std::span(first, last), [=](V x) { return x == value; }, Threads);
+  }
+
 static void
 MyRange(benchmark::internal::Benchmark* b)
 {
@@ -123,3 +409,49 @@ BENCHMARK(chunk_view)->Apply(MyRange);
 BENCHMARK(find_if_simd<4>)->Apply(MyRange);
 BENCHMARK(find_if_simd<1>)->Apply(MyRange);
 BENCHMARK(find_scalar)->Apply(MyRange);
+
+static void
+SmallRange(benchmark::internal::Benchmark* b)
+{
+  for (long i : {1, 3, 7, 8, 15, 17, 31, 33, 63, 100, 255, 400})
+    for (long offset : {0, 1, 3})
+      b->Args({i, offset});
+}
+
+BENCHMARK(find_small<find_overread>)->Apply(SmallRange);
+BENCHMARK(find_small<find_epilogue>)->Apply(SmallRange);
+BENCHMARK(find_small<find_std>)->Apply(SmallRange);
+
+static void
+PatternRange(benchmark::internal::Benchmark* b)
+{ pattern_args(b, {1 << 12, 1 << 18}); }
+
+BENCHMARK(find_all<find_overread>)->Apply(PatternRange);
+BENCHMARK(find_all<find_epilogue>)->Apply(PatternRange);
+BENCHMARK(find_all<find_std>)->Apply(PatternRange);
+BENCHMARK(find_all<find_if_vectors<1>>)->Apply(PatternRange);
+BENCHMARK(find_all<find_if_vectors<4>>)->Apply(PatternRange);
+BENCHMARK(find_all<find_chunk_view>)->Apply(PatternRange);
+BENCHMARK(find_all<find_simd_loads>)->Apply(PatternRange);
+BENCHMARK(find_all<find_parallel<1>>)->Apply(PatternRange)->UseRealTime();
+BENCHMARK(find_all<find_parallel<4>>)->Apply(PatternRange)->UseRealTime();
+
+static void
+ParallelRange(benchmark::internal::Benchmark* b)
+{
+  for (long i = 1 << 20; i <= 1 << 26; i <<= 3)
+    for (long pos = 0; pos < 4; ++pos)
+      b->Args({i, pos});
+}
+
+BENCHMARK(find_any_parallel<1, 1>)->Apply(ParallelRange)->UseRealTime();
+BENCHMARK(find_any_parallel<1, 4>)->Apply(ParallelRange)->UseRealTime();
+BENCHMARK(find_any_parallel<1, 16>)->Apply(ParallelRange)->UseRealTime();
+BENCHMARK(find_any_parallel<4, 1>)->Apply(ParallelRange)->UseRealTime();
+BENCHMARK(find_any_parallel<4, 2>)->Apply(ParallelRange)->UseRealTime();
+BENCHMARK(find_any_parallel<4, 4>)->Apply(ParallelRange)->UseRealTime();
+BENCHMARK(find_any_parallel<4, 8>)->Apply(ParallelRange)->UseRealTime();
+BENCHMARK(find_any_parallel<4, 16>)->Apply(ParallelRange)->UseRealTime();
+BENCHMARK(find_range_parallel<1>)->Apply(ParallelRange)->UseRealTime();
+BENCHMARK(find_range_parallel<4>)->Apply(ParallelRange)->UseRealTime();
+BENCHMARK(find_range_parallel<16>)->Apply(ParallelRange)->UseRealTime();
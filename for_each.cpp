@@ -14,10 +14,11 @@
 #include <ranges>
 #include <vector>
 
+#include "simd_for_each.h"
+
 namespace stdx = vir::stdx;
 
 constexpr long smallest = 2;
-constexpr long largest = 4 << 20;
 
 //using type = float;
 //#define OP(x) x = x * 0.9f + x
@@ -25,8 +26,7 @@ constexpr long largest = 4 << 20;
 using type = int;
 #define OP(x) x += 1
 
-alignas(4096) std::array<char, largest * sizeof(type) * 2> s_buffer;
-std::pmr::monotonic_buffer_resource s_memory {s_buffer.data(), s_buffer.size()};
+mmap_resource s_memory(cache_sweep_max_bytes() * 2);
 
 auto make_data(std::size_t n)
 {
@@ -41,27 +41,33 @@ auto make_data(std::size_t n)
 template <auto pol>
   [[gnu::always_inline]]
   void
-  do_benchmark(benchmark::State& state, auto& v)
+  do_for_each(auto& v)
   {
     if constexpr (std::is_same_v<decltype(pol), decltype(std::execution::seq)>)
       std::for_each(v.begin(), v.end(), [](auto& x) { OP(x); });
+    else if constexpr (execution::is_simd_policy<std::remove_cvref_t<decltype(pol)>>::value)
+      ::for_each(pol, v, [](auto&... x) {
+        ((OP(x)), ...);
+      });
     else
       std::for_each(pol, v.begin(), v.end(), [](auto&... x) {
         ((OP(x)), ...);
       });
-    for (auto _ : state)
-      {
-        asm volatile("");
-        if constexpr (std::is_same_v<decltype(pol), decltype(std::execution::seq)>)
-          std::for_each(v.begin(), v.end(), [](auto& x) { OP(x); });
-        else
-          std::for_each(pol, v.begin(), v.end(), [](auto&... x) {
-            ((OP(x)), ...);
-          });
-        vir::fake_read(v.data());
-        asm volatile("");
-      }
+  }
+
+template <auto pol>
+  [[gnu::always_inline]]
+  void
+  do_benchmark(benchmark::State& state, auto& v)
+  {
+    robust_measure(state, [&] {
+      asm volatile("");
+      do_for_each<pol>(v);
+      vir::fake_read(v.data());
+      asm volatile("");
+    });
     add_throughput_counters<void>(state);
+    add_roofline_counters(state, v.size() * sizeof(type), 2. * v.size() * sizeof(type));
   }
 
 enum Variant
@@ -93,13 +99,60 @@ template <auto pol, Variant var = Aligned>
   foreach_O3(benchmark::State& state)
   { foreach<pol, var>(state); }
 
+// out-of-line instances, so that `make codesize_for_each` can list their code size (plus the
+// size of simd_for_each_serial, if it was not inlined)
+template <auto pol>
+  [[gnu::noinline]]
+  void
+  foreach_kernel(std::span<type> v)
+  { do_for_each<pol>(v); }
+
+template <auto pol>
+  void
+  foreach_outofline(benchmark::State& state)
+  {
+    auto v = make_data(state.range(0));
+    robust_measure(state, [&] {
+      asm volatile("");
+      foreach_kernel<pol>(v);
+      vir::fake_read(v.data());
+      asm volatile("");
+    });
+    add_throughput_counters<void>(state);
+    add_roofline_counters(state, v.size() * sizeof(type), 2. * v.size() * sizeof(type));
+  }
+
+// y += 3 * x, with x misaligned relative to y for the Misaligned variant
+template <auto pol, Variant var = Aligned>
+  void
+  axpy(benchmark::State& state)
+  {
+    const std::size_t n = state.range(0);
+    auto x_data = make_data(n + 1);
+    std::span<const type> x(x_data.data() + (var == Misaligned), n);
+    std::pmr::vector<type> y(n, 1, &s_memory);
+    auto run = [&] {
+      if constexpr (std::is_same_v<decltype(pol), decltype(std::execution::seq)>)
+        std::transform(x.begin(), x.end(), y.begin(), y.begin(),
+                       [](type a, type b) { return b + 3 * a; });
+      else
+        ::for_each(pol, x, y, [](const auto& a, auto& b) { b += 3 * a; });
+    };
+    robust_measure(state, [&] {
+      asm volatile("");
+      run();
+      vir::fake_read(y.data());
+      asm volatile("");
+    });
+    add_throughput_counters<void>(state);
+    add_roofline_counters(state, 2 * n * sizeof(type), 3. * n * sizeof(type));
+  }
+
 static void
 MyRange(benchmark::internal::Benchmark* b)
 {
-  for (long i = smallest; i <= largest; i += i)
-    b->Args({i - 1});
-  for (long i = smallest; i <= largest; i += i)
-    b->Args({i});
+  cache_range<type>(b, smallest);
+  robust_iterations(b);
 }
 
 BENCHMARK(foreach<vir::execution::simd>)->Apply(MyRange);
@@ -120,3 +173,45 @@ BENCHMARK(foreach<std::execution::unseq>)->Apply(MyRange);
 BENCHMARK(foreach_O3<std::execution::unseq>)->Apply(MyRange);
 BENCHMARK(foreach<std::execution::seq>)->Apply(MyRange);
 BENCHMARK(foreach_O3<std::execution::seq>)->Apply(MyRange);
+
+// scaling of the simd_for_each.h policy with the number of threads (robust_measure reports
+// wall-clock time)
+BENCHMARK(foreach<execution::simd.unroll_by<4>()>)->Apply(MyRange);
+BENCHMARK(foreach<execution::simd.unroll_by<4>().parallel<2>()>)->Apply(MyRange);
+BENCHMARK(foreach<execution::simd.unroll_by<4>().parallel<4>()>)->Apply(MyRange);
+BENCHMARK(foreach<execution::simd.unroll_by<4>().parallel<8>()>)->Apply(MyRange);
+BENCHMARK(foreach<execution::simd.unroll_by<4>().parallel<16>()>)->Apply(MyRange);
+BENCHMARK(foreach<execution::simd.unroll_by<4>().parallel<32>()>)->Apply(MyRange);
+BENCHMARK(foreach<execution::simd.prefer_aligned().unroll_by<4>().parallel<8>(), Misaligned>)->Apply(MyRange);
+
+// regular vs. non-temporal write back; streaming stores should win once the data exceeds the LLC
+BENCHMARK(foreach<execution::simd.prefer_aligned().unroll_by<4>()>)->Apply(MyRange);
+BENCHMARK(foreach<execution::simd.unroll_by<4>().streaming_stores()>)->Apply(MyRange);
+BENCHMARK(foreach<execution::simd.prefer_aligned().unroll_by<4>(), Misaligned>)->Apply(MyRange);
+BENCHMARK(foreach<execution::simd.unroll_by<4>().streaming_stores(), Misaligned>)->Apply(MyRange);
+BENCHMARK(foreach<execution::simd.unroll_by<4>().streaming_stores().parallel<8>()>)->Apply(MyRange);
+
+// software prefetch distance (in cache lines) vs. array size
+BENCHMARK(foreach<execution::simd.unroll_by<4>().prefetch<1>()>)->Apply(MyRange);
+BENCHMARK(foreach<execution::simd.unroll_by<4>().prefetch<2>()>)->Apply(MyRange);
+BENCHMARK(foreach<execution::simd.unroll_by<4>().prefetch<4>()>)->Apply(MyRange);
+BENCHMARK(foreach<execution::simd.unroll_by<4>().prefetch<8>()>)->Apply(MyRange);
+BENCHMARK(foreach<execution::simd.unroll_by<4>().prefetch<16>()>)->Apply(MyRange);
+BENCHMARK(foreach<execution::simd.unroll_by<4>().prefetch<32>()>)->Apply(MyRange);
+BENCHMARK(foreach<execution::simd.unroll_by<4>().prefetch<64>()>)->Apply(MyRange);
+
+// two ranges in lockstep
+BENCHMARK(axpy<std::execution::seq>)->Apply(MyRange);
+BENCHMARK(axpy<execution::simd>)->Apply(MyRange);
+BENCHMARK(axpy<execution::simd.unroll_by<4>()>)->Apply(MyRange);
+BENCHMARK(axpy<execution::simd.prefer_aligned().unroll_by<4>()>)->Apply(MyRange);
+BENCHMARK(axpy<execution::simd.unroll_by<4>(), Misaligned>)->Apply(MyRange);
+BENCHMARK(axpy<execution::simd.prefer_aligned().unroll_by<4>(), Misaligned>)->Apply(MyRange);
+
+// recursive halving vs. masked epilogue; the odd sizes of MyRange exercise the epilogue
+BENCHMARK(foreach_outofline<execution::simd>)->Apply(MyRange);
+BENCHMARK(foreach_outofline<execution::simd.masked_epilogue()>)->Apply(MyRange);
+BENCHMARK(foreach_outofline<execution::simd.unroll_by<4>()>)->Apply(MyRange);
+BENCHMARK(foreach_outofline<execution::simd.unroll_by<4>().masked_epilogue()>)->Apply(MyRange);
+BENCHMARK(foreach_outofline<execution::simd.prefer_aligned().unroll_by<4>()>)->Apply(MyRange);
+BENCHMARK(foreach_outofline<execution::simd.prefer_aligned().unroll_by<4>().masked_epilogue()>)->Apply(MyRange);
@@ -1,5 +1,8 @@
 #include <execution>
+#include <functional>
+#include <span>
 #include "benchmark.h"
+#include "simd_for_each.h"
 #include <simd.h>
 #include <simd_reductions.h>
 #include <vir/simd_benchmarking.h>
@@ -14,7 +17,7 @@ struct Scalar
   using Image = std::vector<Pixel>;
 
   static void
-  to_gray(Image& img)
+  to_gray(std::span<Pixel> img)
   {
     for (auto& pixel : img)
       {
@@ -27,7 +30,7 @@ struct Scalar
 struct Unseq : Scalar
 {
   static void
-  to_gray(Image& img)
+  to_gray(std::span<Pixel> img)
   {
     std::for_each(std::execution::unseq, img.begin(), img.end(), [](auto& pixel) {
       const auto gray = (pixel.r * 11 + pixel.g * 16 + pixel.b * 5) / 32;
@@ -47,7 +50,7 @@ struct SimdPixel
   static constexpr unsigned gray_coeff[4] = {11, 16, 5, 1};
 
   static void
-  to_gray(auto& img)
+  to_gray(std::span<Pixel> img)
   {
     constexpr Pixel32Mask mask([](auto i) { return i < 3; });
     for (auto& p8 : img)
@@ -68,34 +71,279 @@ struct DataParallel
 
   using PixelV = std::simd<Pixel, std::simd<Pixel>::size() * ILP>;
 
+  static constexpr Pixel threshold_level = 128;
+
+  static PixelV
+  gray(PixelV pixels)
+  {
+    const auto a =  pixels >> 24;
+    const auto r = (pixels >> 16) & 0xffU;
+    const auto g = (pixels >> 8) & 0xffU;
+    const auto b =  pixels & 0xffU;
+    const auto gray = (r * 11u + g * 16u + b * 5u) / 32u;
+    return gray | (gray << 8) | (gray << 16) | (a << 24);
+  }
+
+  // White where the blue channel (i.e. the gray level after gray()) is at least
+  // threshold_level, black otherwise. Alpha is kept.
+  static PixelV
+  threshold(PixelV pixels)
+  {
+    return std::simd_select((pixels & 0xffU) >= threshold_level, pixels | 0x00ffffffU,
+                            pixels & 0xff000000U);
+  }
+
+  // 3x3 binomial blur ([1 2 1] x [1 2 1] / 16) of all four channels. Each pointer points to the
+  // left neighbour of the first output pixel in the row above, the same row, and the row below.
+  // The channels are summed pairwise in 16-bit fields (b+r and g+a), which cannot overflow
+  // since 16 * 255 < 2^16.
+  static PixelV
+  blur_3x3(const Pixel* above, const Pixel* row, const Pixel* below)
+  {
+    PixelV lo = 0u;
+    PixelV hi = 0u;
+    for (auto [ptr, weight] : {std::pair{above, 1u}, {row, 2u}, {below, 1u}})
+      {
+        const PixelV l(ptr), c(ptr + 1), r(ptr + 2);
+        lo += ((l & 0x00ff00ffU) + ((c & 0x00ff00ffU) << 1) + (r & 0x00ff00ffU)) * weight;
+        hi += (((l >> 8) & 0x00ff00ffU) + (((c >> 8) & 0x00ff00ffU) << 1)
+                 + ((r >> 8) & 0x00ff00ffU)) * weight;
+      }
+    return ((lo >> 4) & 0x00ff00ffU) | (((hi >> 4) & 0x00ff00ffU) << 8);
+  }
+
+  // img.size() must be a multiple of PixelV::size()
   static void
-  to_gray(Image& img)
+  to_gray(std::span<Pixel> img)
   {
     for (auto it = img.begin(); it < img.end(); it += PixelV::size())
       {
         PixelV pixels(it);
-        const auto a =  pixels >> 24;
-        const auto r = (pixels >> 16) & 0xffU;
-        const auto g = (pixels >> 8) & 0xffU;
-        const auto b =  pixels & 0xffU;
-        const auto gray = (r * 11u + g * 16u + b * 5u) / 32u;
-        pixels = gray | (gray << 8) | (gray << 16) | (a << 24);
+        pixels = gray(pixels);
         pixels.copy_to(it);
       }
   }
 };
 
+// One uint8_t plane per channel. The conversions from/to the interleaved 0xAARRGGBB layout of
+// DataParallel transpose 4 x V::size() bytes via truncating/zero-extending conversions between
+// uint32_t and uint8_t vectors, which compile to byte shuffles / packs and unpacks.
+struct Planar
+{
+  using Pixel = Scalar::Pixel;
+
+  using V = std::simd<std::uint8_t>;
+  using V16 = std::rebind_simd_t<std::uint16_t, V>;
+  using V32 = std::rebind_simd_t<std::uint32_t, V>;
+
+  struct Image
+  {
+    std::vector<std::uint8_t> b, g, r, a;
+
+    explicit Image(std::size_t size)
+    : b(size), g(size), r(size), a(size)
+    {}
+  };
+
+  // packed.size() must be a multiple of V::size()
+  static void
+  deinterleave(std::span<const std::uint32_t> packed, Image& img)
+  {
+    for (std::size_t i = 0; i < packed.size(); i += V::size())
+      {
+        const V32 pixels(packed.begin() + i);
+        static_cast<V>(pixels).copy_to(img.b.begin() + i);
+        static_cast<V>(pixels >> 8).copy_to(img.g.begin() + i);
+        static_cast<V>(pixels >> 16).copy_to(img.r.begin() + i);
+        static_cast<V>(pixels >> 24).copy_to(img.a.begin() + i);
+      }
+  }
+
+  // packed.size() must be a multiple of V::size()
+  static void
+  interleave(const Image& img, std::span<std::uint32_t> packed)
+  {
+    for (std::size_t i = 0; i < packed.size(); i += V::size())
+      {
+        const V32 pixels = static_cast<V32>(V(img.b.begin() + i))
+                             | (static_cast<V32>(V(img.g.begin() + i)) << 8)
+                             | (static_cast<V32>(V(img.r.begin() + i)) << 16)
+                             | (static_cast<V32>(V(img.a.begin() + i)) << 24);
+        pixels.copy_to(packed.begin() + i);
+      }
+  }
+
+  // The plane size must be a multiple of V::size(). The weighted sum is at most 32 * 255 and
+  // thus fits into 16-bit lanes.
+  static void
+  to_gray(Image& img)
+  {
+    for (std::size_t i = 0; i < img.b.size(); i += V::size())
+      {
+        const V16 b = static_cast<V16>(V(img.b.begin() + i));
+        const V16 g = static_cast<V16>(V(img.g.begin() + i));
+        const V16 r = static_cast<V16>(V(img.r.begin() + i));
+        const V gray = static_cast<V>((r * std::uint16_t(11) + g * std::uint16_t(16)
+                                         + b * std::uint16_t(5)) >> 5);
+        gray.copy_to(img.b.begin() + i);
+        gray.copy_to(img.g.begin() + i);
+        gray.copy_to(img.r.begin() + i);
+      }
+  }
+};
+
 template <typename Image>
   Image
   make_image(std::size_t size)
   { return Image(size); }
 
+// A width x height image whose rows start stride pixels apart. The stride is padded to a
+// multiple of row_alignment pixels, so that every row (and every tile of a multiple of
+// row_alignment pixels width) can be processed with full vectors.
+template <typename Pixel>
+  struct Image2D
+  {
+    static constexpr std::size_t row_alignment = 64;
+
+    std::size_t width, height, stride;
+    std::vector<Pixel> pixels;
+
+    Image2D(std::size_t w, std::size_t h)
+    : width(w), height(h),
+      stride((w + row_alignment - 1) / row_alignment * row_alignment),
+      pixels(h * stride)
+    {}
+
+    std::span<Pixel>
+    row(std::size_t y, std::size_t x0, std::size_t x1)
+    { return {pixels.data() + y * stride + x0, x1 - x0}; }
+
+    std::span<const Pixel>
+    row(std::size_t y, std::size_t x0, std::size_t x1) const
+    { return {pixels.data() + y * stride + x0, x1 - x0}; }
+  };
+
+// Runs Variant::to_gray row by row on tiles of tile_width x tile_height pixels (including the
+// padding at the end of the rows). tile_width must be a multiple of Image2D::row_alignment.
+// threads workers (including the calling thread) pull tiles off a shared counter.
+template <typename Variant>
+  void
+  to_gray_tiled(Image2D<typename Variant::Pixel>& img, std::size_t tile_width,
+                std::size_t tile_height, int threads)
+  {
+    const std::size_t tiles_x = (img.stride + tile_width - 1) / tile_width;
+    const std::size_t tiles_y = (img.height + tile_height - 1) / tile_height;
+    std::atomic<std::size_t> next_tile = 0;
+    auto process_tiles = [&] {
+      for (std::size_t t = next_tile++; t < tiles_x * tiles_y; t = next_tile++)
+        {
+          const std::size_t x0 = t % tiles_x * tile_width;
+          const std::size_t x1 = std::min(x0 + tile_width, img.stride);
+          const std::size_t y0 = t / tiles_x * tile_height;
+          const std::size_t y1 = std::min(y0 + tile_height, img.height);
+          for (std::size_t y = y0; y < y1; ++y)
+            Variant::to_gray(img.row(y, x0, x1));
+        }
+    };
+    if (threads <= 1)
+      process_tiles();
+    else
+      simd_thread_pool::instance().run(threads - 1, process_tiles);
+  }
+
+// Composable pipeline passes on packed pixels. A per-pixel stage maps a PixelV to a PixelV; chain()
+// composes several into one. A stencil stage computes a PixelV from its 3x3 neighbourhood, given
+// pointers to the left neighbour of the first output pixel in the row above, the same row, and
+// the row below (like DataParallel::blur_3x3). Pixels outside the image repeat the nearest edge
+// pixel.
+template <int ILP>
+  struct PixelPipeline
+  {
+    using Stages = DataParallel<ILP>;
+    using Pixel = typename Stages::Pixel;
+    using PixelV = typename Stages::PixelV;
+
+    static constexpr auto
+    chain(auto... stages)
+    { return [=](PixelV pixels) { ((pixels = stages(pixels)), ...); return pixels; }; }
+
+    // dst = stage(src) for all pixels (including row padding). src and dst may be the same image.
+    static void
+    pixel_pass(const Image2D<Pixel>& src, Image2D<Pixel>& dst, auto stage)
+    {
+      for (std::size_t y = 0; y < src.height; ++y)
+        {
+          const Pixel* in = src.row(y, 0, src.stride).data();
+          Pixel* out = dst.row(y, 0, dst.stride).data();
+          for (std::size_t x = 0; x < src.stride; x += PixelV::size())
+            stage(PixelV(in + x)).copy_to(out + x);
+        }
+    }
+
+    // dst = post(stencil(pre(src))) with the pre stages of only three rows kept in flight.
+    // src and dst may be the same image.
+    static void
+    stencil_pass(const Image2D<Pixel>& src, Image2D<Pixel>& dst, auto pre, auto stencil,
+                 auto post)
+    {
+      // every buffered row has a guard pixel on either side
+      const std::size_t buf_stride = src.stride + 2;
+      std::vector<Pixel> buffer(3 * buf_stride);
+      auto buffered_row = [&](std::size_t y) { return buffer.data() + y % 3 * buf_stride; };
+      auto fill = [&](std::size_t y) {
+        const Pixel* in = src.row(y, 0, src.stride).data();
+        Pixel* out = buffered_row(y);
+        for (std::size_t x = 0; x < src.stride; x += PixelV::size())
+          pre(PixelV(in + x)).copy_to(out + 1 + x);
+        out[0] = out[1];
+        out[src.width + 1] = out[src.width];
+      };
+      fill(0);
+      for (std::size_t y = 0; y < src.height; ++y)
+        {
+          if (y + 1 < src.height)
+            fill(y + 1);
+          const Pixel* above = buffered_row(y == 0 ? 0 : y - 1);
+          const Pixel* row = buffered_row(y);
+          const Pixel* below = buffered_row(y + 1 < src.height ? y + 1 : y);
+          Pixel* out = dst.row(y, 0, dst.stride).data();
+          for (std::size_t x = 0; x < src.stride; x += PixelV::size())
+            post(stencil(above + x, row + x, below + x)).copy_to(out + x);
+        }
+    }
+  };
+
+// gray -> 3x3 blur -> threshold. sequential() makes one pass over the image per stage. fused()
+// makes a single pass: every source row goes through gray before the blur into the rolling
+// buffer, and threshold is applied before the output row is stored. Both leave src unchanged and
+// produce the same dst.
+template <int ILP>
+  struct GrayBlurThreshold : PixelPipeline<ILP>
+  {
+    using Base = PixelPipeline<ILP>;
+    using typename Base::Stages;
+    using typename Base::Pixel;
+
+    static void
+    sequential(const Image2D<Pixel>& src, Image2D<Pixel>& dst)
+    {
+      Base::pixel_pass(src, dst, Stages::gray);
+      Base::stencil_pass(dst, dst, std::identity(), Stages::blur_3x3, std::identity());
+      Base::pixel_pass(dst, dst, Stages::threshold);
+    }
+
+    static void
+    fused(const Image2D<Pixel>& src, Image2D<Pixel>& dst)
+    { Base::stencil_pass(src, dst, Stages::gray, Stages::blur_3x3, Stages::threshold); }
+  };
+
 template <typename Variant>
   void
   bench(benchmark::State &state)
   {
     auto img = make_image<typename Variant::Image>(state.range(0));
     asm("" : "+m"(img));
+    perf_scope perf;
     for (auto _ : state) {
       Variant::to_gray(img);
       asm("" :: "m"(img));
@@ -115,6 +363,60 @@ template <typename var>
   bench_O3(benchmark::State &state)
   { bench<var>(state); }
 
+// Planar::to_gray on an interleaved image, including the conversion to planes and back
+[[gnu::optimize("-O2"), gnu::flatten]]
+static void
+bench_planar_roundtrip(benchmark::State &state)
+{
+  std::vector<std::uint32_t> packed(state.range(0));
+  Planar::Image planes(state.range(0));
+  asm("" : "+m"(packed), "+m"(planes));
+  perf_scope perf;
+  for (auto _ : state) {
+    Planar::deinterleave(packed, planes);
+    Planar::to_gray(planes);
+    Planar::interleave(planes, packed);
+    asm("" :: "m"(packed));
+  }
+  add_throughput_counters<std::uint32_t>(state);
+}
+
+// state.range(0) x state.range(1) image in tiles of state.range(2) x state.range(3)
+template <typename Variant, int Threads>
+  void
+  bench_tiled(benchmark::State &state)
+  {
+    Image2D<typename Variant::Pixel> img(state.range(0), state.range(1));
+    asm("" : "+m"(img));
+    perf_scope perf;
+    for (auto _ : state) {
+      to_gray_tiled<Variant>(img, state.range(2), state.range(3), Threads);
+      asm("" :: "m"(img));
+    }
+    add_throughput_counters<typename Variant::Pixel>(state, 1, img.stride * img.height);
+  }
+
+// state.range(0) x state.range(1) image through gray -> blur -> threshold
+template <int ILP, bool Fused>
+  void
+  bench_pipeline(benchmark::State &state)
+  {
+    using Pipeline = GrayBlurThreshold<ILP>;
+    using Pixel = typename Pipeline::Pixel;
+    Image2D<Pixel> src(state.range(0), state.range(1));
+    Image2D<Pixel> dst(state.range(0), state.range(1));
+    asm("" : "+m"(src), "+m"(dst));
+    perf_scope perf;
+    for (auto _ : state) {
+      if constexpr (Fused)
+        Pipeline::fused(src, dst);
+      else
+        Pipeline::sequential(src, dst);
+      asm("" :: "m"(dst));
+    }
+    add_throughput_counters<Pixel>(state, 1, src.stride * src.height);
+  }
+
 constexpr long smallest = 32 * 32;
 constexpr long largest = 16 << 20;
 
@@ -132,7 +434,45 @@ BENCHMARK(bench_O2<DataParallel<4>>)->Apply(MyRange);
 BENCHMARK(bench_O2<SimdPixel>)->Apply(MyRange);
 BENCHMARK(bench_O2<Scalar>)->Apply(MyRange);
 BENCHMARK(bench_O2<Unseq>)->Apply(MyRange);
+BENCHMARK(bench_O2<Planar>)->Apply(MyRange);
+BENCHMARK(bench_planar_roundtrip)->Apply(MyRange);
 BENCHMARK(bench_O3<DataParallel<1>>)->Apply(MyRange);
 BENCHMARK(bench_O3<SimdPixel>)->Apply(MyRange);
 BENCHMARK(bench_O3<Scalar>)->Apply(MyRange);
 BENCHMARK(bench_O3<Unseq>)->Apply(MyRange);
+
+// 4K and 8K frames in rows of tiles, square tiles, and tall tiles
+static void
+TileRange(benchmark::internal::Benchmark* b)
+{
+  for (long w : {3840, 7680})
+    {
+      const long h = w * 9 / 16;
+      for (auto [tw, th] : {std::pair<long, long>{w, 8}, {1024, 16}, {256, 64}, {64, 256}})
+        b->Args({w, h, tw, th});
+    }
+}
+
+BENCHMARK(bench_tiled<DataParallel<4>, 1>)->Apply(TileRange)->UseRealTime();
+BENCHMARK(bench_tiled<DataParallel<4>, 2>)->Apply(TileRange)->UseRealTime();
+BENCHMARK(bench_tiled<DataParallel<4>, 4>)->Apply(TileRange)->UseRealTime();
+BENCHMARK(bench_tiled<DataParallel<4>, 8>)->Apply(TileRange)->UseRealTime();
+BENCHMARK(bench_tiled<DataParallel<4>, 16>)->Apply(TileRange)->UseRealTime();
+BENCHMARK(bench_tiled<SimdPixel, 1>)->Apply(TileRange)->UseRealTime();
+BENCHMARK(bench_tiled<SimdPixel, 8>)->Apply(TileRange)->UseRealTime();
+BENCHMARK(bench_tiled<Scalar, 1>)->Apply(TileRange)->UseRealTime();
+BENCHMARK(bench_tiled<Scalar, 8>)->Apply(TileRange)->UseRealTime();
+
+// From L2-sized images to 8K frames
+static void
+PipelineRange(benchmark::internal::Benchmark* b)
+{
+  for (auto [w, h] : {std::pair<long, long>{256, 256}, {1024, 768}, {1920, 1080}, {3840, 2160},
+                      {7680, 4320}})
+    b->Args({w, h});
+}
+
+BENCHMARK(bench_pipeline<1, false>)->Apply(PipelineRange);
+BENCHMARK(bench_pipeline<1, true>)->Apply(PipelineRange);
+BENCHMARK(bench_pipeline<4, false>)->Apply(PipelineRange);
+BENCHMARK(bench_pipeline<4, true>)->Apply(PipelineRange);
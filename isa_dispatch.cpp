@@ -0,0 +1,114 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright © 2023 GSI Helmholtzzentrum fuer Schwerionenforschung GmbH
+ *                  Matthias Kretz <m.kretz@gsi.de>
+ */
+// Runs the per-ISA variants <title>.<isa> of a benchmark (see add_benchmark in CMakeLists.txt)
+// that the CPU supports. All other arguments are passed on.
+//
+// --isa=best (default) runs the best variant, --isa=all every supported variant, and
+// --isa=sse4.2,avx2 the listed ones. If several variants run, --benchmark_out=F writes the
+// results of each variant to F.<isa> (compare them with compare_csv.sh for per-ISA speedups).
+
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+struct isa_variant
+{
+  const char* name;
+  bool (*supported)();
+};
+
+// in ascending order; the variants are compiled with -march=x86-64-v2/v3/v4
+static const isa_variant variants[] = {
+  {"sse4.2", [] { return bool(__builtin_cpu_supports("x86-64-v2")); }},
+  {"avx2", [] { return bool(__builtin_cpu_supports("x86-64-v3")); }},
+  {"avx512", [] { return bool(__builtin_cpu_supports("x86-64-v4")); }},
+};
+
+static int
+run(const fs::path& exe, std::vector<std::string> args)
+{
+  std::vector<char*> argv;
+  argv.push_back(const_cast<char*>(exe.c_str()));
+  for (std::string& a : args)
+    argv.push_back(a.data());
+  argv.push_back(nullptr);
+  const pid_t pid = fork();
+  if (pid == 0)
+    {
+      execv(argv[0], argv.data());
+      std::cerr << "cannot execute " << exe << '\n';
+      std::_Exit(127);
+    }
+  int status = 0;
+  if (pid < 0 or waitpid(pid, &status, 0) < 0)
+    return 1;
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+int
+main(int argc, char** argv)
+{
+  __builtin_cpu_init();
+  const fs::path dir = fs::read_symlink("/proc/self/exe").parent_path();
+  std::string_view selection = "best";
+  std::string out;
+  std::vector<std::string> args;
+  for (int i = 1; i < argc; ++i)
+    {
+      const std::string_view arg = argv[i];
+      if (arg.starts_with("--isa="))
+        selection = arg.substr(6);
+      else
+        {
+          if (arg.starts_with("--benchmark_out="))
+            out = arg.substr(16);
+          args.emplace_back(arg);
+        }
+    }
+
+  std::vector<const isa_variant*> selected;
+  for (const isa_variant& v : variants)
+    {
+      const bool listed = selection == "best" or selection == "all"
+                            or ("," + std::string(selection) + ",").find(
+                                 "," + std::string(v.name) + ",") != std::string::npos;
+      if (listed and v.supported() and fs::exists(dir / (BENCHMARK_TITLE "." + std::string(v.name))))
+        selected.push_back(&v);
+    }
+  if (selection == "best" and not selected.empty())
+    selected.erase(selected.begin(), selected.end() - 1);
+  if (selected.empty())
+    {
+      std::cerr << "no " << BENCHMARK_TITLE << " variant for --isa=" << selection
+                << " is supported by this CPU\n";
+      return 1;
+    }
+
+  if (selected.size() == 1)
+    {
+      std::cerr << "running " << BENCHMARK_TITLE "." << selected.front()->name << '\n';
+      return run(dir / (BENCHMARK_TITLE "." + std::string(selected.front()->name)), args);
+    }
+
+  int status = 0;
+  for (const isa_variant* v : selected)
+    {
+      std::vector<std::string> variant_args = args;
+      if (not out.empty())
+        for (std::string& a : variant_args)
+          if (a.starts_with("--benchmark_out="))
+            a += '.' + std::string(v->name);
+      std::cerr << "running " << BENCHMARK_TITLE "." << v->name << '\n';
+      status |= run(dir / (BENCHMARK_TITLE "." + std::string(v->name)), variant_args);
+    }
+  return status;
+}
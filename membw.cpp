@@ -0,0 +1,194 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright © 2023 GSI Helmholtzzentrum fuer Schwerionenforschung GmbH
+ *                  Matthias Kretz <m.kretz@gsi.de>
+ */
+#include "benchmark.h"
+#include <vir/simd.h>
+#include <vir/simd_benchmarking.h>
+
+#include <algorithm>
+#include <array>
+#include <numeric>
+#include <random>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include "simd_for_each.h"
+
+namespace stdx = vir::stdx;
+
+using type = double;
+
+constexpr long smallest = 16;
+
+// STREAM kernels (a = b, a = s * b, a = b + c, a = b + s * c) and the read-only, write-only,
+// and read-write traffic of a single array.
+enum stream_kernel
+{
+  copy, scale, add, triad, read_only, write_only, write_nt, read_write
+};
+
+// The number of arrays each kernel reads or writes (STREAM counts copy as 2 arrays, i.e. does
+// not count the read for ownership of the stores).
+constexpr int
+arrays_moved(stream_kernel k)
+{
+  switch (k)
+    {
+    case add:
+    case triad:
+      return 3;
+    case copy:
+    case scale:
+    case read_write:
+      return 2;
+    default:
+      return 1;
+    }
+}
+
+mmap_resource s_memory(3 * (cache_sweep_max_bytes() + 4096));
+
+// Three cache line aligned arrays of n elements. The arrays start at different offsets into a
+// page, so that they do not alias in the L1 (4k aliasing).
+std::array<std::span<type>, 3>
+make_arrays(std::size_t n)
+{
+  s_memory.release();
+  std::array<std::span<type>, 3> arrays;
+  const type init[] = {1, 2, .5};
+  for (int k = 0; k < 3; ++k)
+    {
+      auto* ptr = static_cast<type*>(s_memory.allocate(n * sizeof(type) + 4096, 4096));
+      arrays[k] = {ptr + k * simd_cache_line_size / sizeof(type), n};
+      std::ranges::fill(arrays[k], init[k]);
+    }
+  return arrays;
+}
+
+template <stream_kernel K>
+  void
+  stream(benchmark::State& state)
+  {
+    const std::size_t n = state.range(0);
+    const int threads = state.range(1);
+    auto [a, b, c] = make_arrays(n);
+    const type s = 3;
+    constexpr auto pol = execution::simd.prefer_aligned().unroll_by<4>();
+    std::vector<simd_padded<type>> sums(threads);
+    // every thread works on cache line aligned chunks of all arrays at the same offsets
+    auto run = [&] {
+      simd_parallel_chunks(a, threads, [&](int worker, std::span<type> chunk) {
+        const std::size_t first = chunk.data() - a.data();
+        std::span<const type> x = b.subspan(first, chunk.size());
+        std::span<const type> z = c.subspan(first, chunk.size());
+        if constexpr (K == copy)
+          ::for_each(pol, x, chunk, [](const auto& xv, auto& y) { y = xv; });
+        else if constexpr (K == scale)
+          ::for_each(pol, x, chunk, [s](const auto& xv, auto& y) { y = s * xv; });
+        else if constexpr (K == add)
+          ::for_each(pol, x, z, chunk, [](const auto& xv, const auto& zv, auto& y) {
+            y = xv + zv;
+          });
+        else if constexpr (K == triad)
+          ::for_each(pol, x, z, chunk, [s](const auto& xv, const auto& zv, auto& y) {
+            y = xv + s * zv;
+          });
+        else if constexpr (K == read_only)
+          sums[worker].value += ::reduce(pol, std::span<const type>(chunk), type());
+        else if constexpr (K == write_only)
+          ::for_each(pol, chunk, [](auto&... y) { ((y = 1), ...); });
+        else if constexpr (K == write_nt)
+          ::for_each(execution::simd.unroll_by<4>().streaming_stores(), chunk,
+                     [](auto&... y) { ((y = 1), ...); });
+        else if constexpr (K == read_write)
+          ::for_each(pol, chunk, [](auto&... y) { ((y += 1), ...); });
+      });
+    };
+    robust_measure(state, [&] {
+      asm volatile("");
+      run();
+      vir::fake_read(a.data());
+      asm volatile("");
+    });
+    for (const auto& sum : sums)
+      vir::fake_read(sum.value);
+    add_throughput_counters<type>(state, arrays_moved(K));
+  }
+
+// A node per cache line, linked in random order.
+struct alignas(simd_cache_line_size) chase_node
+{
+  chase_node* next;
+};
+
+// Load-to-use latency: a chain of dependent loads through a random cycle over all nodes, which
+// the hardware prefetchers cannot follow.
+static void
+pointer_chase(benchmark::State& state)
+{
+  const std::size_t n = state.range(0);
+  s_memory.release();
+  std::span<chase_node> nodes(
+    static_cast<chase_node*>(s_memory.allocate(n * sizeof(chase_node), 4096)), n);
+  // Sattolo's algorithm yields a permutation with a single cycle
+  std::vector<std::size_t> order(n);
+  std::iota(order.begin(), order.end(), 0);
+  std::mt19937_64 gen(1);
+  for (std::size_t i = n - 1; i > 0; --i)
+    std::swap(order[i], order[std::uniform_int_distribution<std::size_t>(0, i - 1)(gen)]);
+  for (std::size_t i = 0; i < n; ++i)
+    nodes[i].next = &nodes[order[i]];
+
+  chase_node* p = nodes.data();
+  robust_measure(state, [&] {
+    for (std::size_t i = 0; i < n; ++i)
+      p = p->next;
+    vir::fake_read(p);
+  });
+  add_throughput_counters<void>(state);
+  benchmark::Counter latency = per_second(state, n / 1e9);
+  latency.flags = benchmark::Counter::Flags(latency.flags | benchmark::Counter::kInvert);
+  state.counters["latency / ns"] = latency;
+}
+
+// The size sweep on one thread, plus for every thread count array sizes that fill half of each
+// cache level (the private levels once per thread) and a size beyond the LLC.
+static void
+MyRange(benchmark::internal::Benchmark* b)
+{
+  b->ArgNames({"", "threads"});
+  for (long n : cache_range_sizes<type>(smallest))
+    b->Args({n, 1});
+  const auto& caches = detected_cache_sizes();
+  const int max_threads = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<int> thread_counts;
+  for (int t = 2; t < max_threads; t *= 2)
+    thread_counts.push_back(t);
+  if (max_threads > 1)
+    thread_counts.push_back(max_threads);
+  for (int t : thread_counts)
+    for (std::size_t bytes : {t * caches.l1d / 2, t * caches.l2 / 2, caches.l3 / 2,
+                              cache_sweep_max_bytes()})
+      b->Args({long(std::min(bytes, cache_sweep_max_bytes()) / (3 * sizeof(type))), t});
+  robust_iterations(b);
+}
+
+static void
+ChaseRange(benchmark::internal::Benchmark* b)
+{
+  cache_range<chase_node>(b, smallest);
+  robust_iterations(b);
+}
+
+BENCHMARK(stream<copy>)->Apply(MyRange);
+BENCHMARK(stream<scale>)->Apply(MyRange);
+BENCHMARK(stream<add>)->Apply(MyRange);
+BENCHMARK(stream<triad>)->Apply(MyRange);
+BENCHMARK(stream<read_only>)->Apply(MyRange);
+BENCHMARK(stream<write_only>)->Apply(MyRange);
+BENCHMARK(stream<write_nt>)->Apply(MyRange);
+BENCHMARK(stream<read_write>)->Apply(MyRange);
+
+BENCHMARK(pointer_chase)->Apply(ChaseRange);
@@ -0,0 +1,327 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright © 2023 GSI Helmholtzzentrum fuer Schwerionenforschung GmbH
+ *                  Matthias Kretz <m.kretz@gsi.de>
+ */
+#ifndef NEAREST_NEIGHBOR_H
+#define NEAREST_NEIGHBOR_H
+
+#include <vir/simd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <numeric>
+#include <span>
+#include <vector>
+
+#include "simd_for_each.h"
+
+namespace stdx = vir::stdx;
+
+template <typename T> struct Point {
+  T x, y, z;
+};
+
+template <typename T> constexpr T sqr(T x) { return x * x; }
+
+template <typename T, typename U> constexpr auto distance(Point<T> a, Point<U> b)
+{
+  return sqr(a.x - b.x) + sqr(a.y - b.y) + sqr(a.z - b.z);
+}
+
+// Squared distance and index of a nearest point. Ties go to the smaller index.
+struct nearest_result {
+  float distance = std::numeric_limits<float>::infinity();
+  std::size_t index = 0;
+
+  friend constexpr bool operator<(const nearest_result& a, const nearest_result& b)
+  { return a.distance < b.distance or (a.distance == b.distance and a.index < b.index); }
+
+  friend constexpr nearest_result min(const nearest_result& a, const nearest_result& b)
+  { return b < a ? b : a; }
+};
+
+// Searches the points [first, last) of the SoA points for the nearest to to_find. Every lane
+// keeps its own best distance and the iteration it was found in, so the hot loop has no
+// branches. The iteration counter is a float, so last - first must not exceed
+// 2^24 * V::size().
+template <typename V = stdx::native_simd<float>>
+nearest_result nearest_in(const Point<std::vector<float>>& points, const Point<float> to_find,
+                          std::size_t first, std::size_t last)
+{
+  V best = std::numeric_limits<float>::infinity();
+  V best_iteration = 0;
+  V iteration = 0;
+  std::size_t i = first;
+  for (; i + V::size() <= last; i += V::size()) {
+    const Point<V> a{V(&points.x[i], stdx::element_aligned),
+                     V(&points.y[i], stdx::element_aligned),
+                     V(&points.z[i], stdx::element_aligned)};
+    const V d = distance(a, to_find);
+    const auto closer = d < best;
+    where(closer, best) = d;
+    where(closer, best_iteration) = iteration;
+    iteration += 1;
+  }
+  nearest_result r;
+  for (std::size_t lane = 0; lane < V::size(); ++lane) {
+    r = min(r, {best[lane], first + std::size_t(best_iteration[lane]) * V::size() + lane});
+  }
+  for (; i < last; ++i) {
+    r = min(r, {distance(Point<float>{points.x[i], points.y[i], points.z[i]}, to_find), i});
+  }
+  return r;
+}
+
+// Points per chunk handed to a worker of index_of_nearest_parallel.
+inline constexpr std::size_t nearest_chunk_size = 1 << 14;
+
+// Index of the point nearest to to_find. The points are split into chunks that threads
+// workers (including the calling thread) pull off a shared counter.
+template <typename V = stdx::native_simd<float>>
+std::size_t index_of_nearest_parallel(const Point<std::vector<float>>& points,
+                                      const Point<float> to_find, int threads)
+{
+  const std::size_t n = points.x.size();
+  const std::size_t n_chunks = (n + nearest_chunk_size - 1) / nearest_chunk_size;
+  std::atomic<std::size_t> next_chunk = 0;
+  std::mutex mutex;
+  nearest_result result;
+  auto search_chunks = [&] {
+    nearest_result local;
+    for (std::size_t c = next_chunk++; c < n_chunks; c = next_chunk++) {
+      const std::size_t first = c * nearest_chunk_size;
+      local = min(local, nearest_in<V>(points, to_find, first,
+                                       std::min(first + nearest_chunk_size, n)));
+    }
+    std::scoped_lock lock(mutex);
+    result = min(result, local);
+  };
+  if (threads <= 1 or n_chunks <= 1) {
+    search_chunks();
+  } else {
+    simd_thread_pool::instance().run(threads - 1, search_chunks);
+  }
+  return result.index;
+}
+
+// The k best results seen so far, sorted by distance, stored in the caller's buffer.
+class nearest_top_k
+{
+  std::span<nearest_result> _best;
+  std::size_t _size = 0;
+
+public:
+  explicit nearest_top_k(std::span<nearest_result> buffer) : _best(buffer) {}
+
+  // Distance a new point has to beat to get in.
+  float threshold() const
+  { return _size < _best.size() ? std::numeric_limits<float>::infinity() : _best.back().distance; }
+
+  void insert(const nearest_result r)
+  {
+    std::size_t j = std::min(_size, _best.size() - 1);
+    if (_size < _best.size()) {
+      ++_size;
+    } else if (not(r < _best[j])) {
+      return;
+    }
+    for (; j > 0 and r < _best[j - 1]; --j) {
+      _best[j] = _best[j - 1];
+    }
+    _best[j] = r;
+  }
+};
+
+// Adds the points [first, last) to top. Points are visited in order, so a candidate only
+// needs to beat the threshold to be inserted; the scalar insert runs only for those lanes.
+template <typename V = stdx::native_simd<float>>
+void nearest_k_in(const Point<std::vector<float>>& points, const Point<float> to_find,
+                  std::size_t first, std::size_t last, nearest_top_k& top)
+{
+  V threshold = top.threshold();
+  std::size_t i = first;
+  for (; i + V::size() <= last; i += V::size()) {
+    const Point<V> a{V(&points.x[i], stdx::element_aligned),
+                     V(&points.y[i], stdx::element_aligned),
+                     V(&points.z[i], stdx::element_aligned)};
+    const V d = distance(a, to_find);
+    const auto closer = d < threshold;
+    if (any_of(closer)) [[unlikely]] {
+      for (std::size_t lane = 0; lane < V::size(); ++lane) {
+        if (closer[lane]) {
+          top.insert({d[lane], i + lane});
+        }
+      }
+      threshold = top.threshold();
+    }
+  }
+  for (; i < last; ++i) {
+    top.insert({distance(Point<float>{points.x[i], points.y[i], points.z[i]}, to_find), i});
+  }
+}
+
+// Points per block of k_nearest_batched: 3 * 4096 floats (48 KiB) stay in L2 while a block
+// of queries is checked against them.
+inline constexpr std::size_t nearest_point_block = 4096;
+
+// Returns the indices of the k nearest points (1 <= k <= number of points) for each query,
+// queries.size() rows of k indices sorted by distance. Queries are processed in blocks of
+// query_block; each block streams over all points once, one block of nearest_point_block
+// points at a time. Query blocks are distributed over threads workers.
+template <typename V = stdx::native_simd<float>>
+std::vector<std::size_t>
+k_nearest_batched(const Point<std::vector<float>>& points, std::span<const Point<float>> queries,
+                  std::size_t k, std::size_t query_block = 64, int threads = 1)
+{
+  const std::size_t n = points.x.size();
+  const std::size_t n_query_blocks = (queries.size() + query_block - 1) / query_block;
+  std::vector<nearest_result> best(queries.size() * k);
+  std::atomic<std::size_t> next_block = 0;
+  auto search_blocks = [&] {
+    std::vector<nearest_top_k> tops;
+    for (std::size_t b = next_block++; b < n_query_blocks; b = next_block++) {
+      const std::size_t q0 = b * query_block;
+      const std::size_t q1 = std::min(q0 + query_block, queries.size());
+      tops.clear();
+      for (std::size_t q = q0; q < q1; ++q) {
+        tops.emplace_back(std::span(best).subspan(q * k, k));
+      }
+      for (std::size_t first = 0; first < n; first += nearest_point_block) {
+        const std::size_t last = std::min(first + nearest_point_block, n);
+        for (std::size_t q = q0; q < q1; ++q) {
+          nearest_k_in<V>(points, queries[q], first, last, tops[q - q0]);
+        }
+      }
+    }
+  };
+  if (threads <= 1 or n_query_blocks <= 1) {
+    search_blocks();
+  } else {
+    simd_thread_pool::instance().run(threads - 1, search_blocks);
+  }
+  std::vector<std::size_t> indices(best.size());
+  std::ranges::transform(best, indices.begin(), &nearest_result::index);
+  return indices;
+}
+
+// k-d tree over a set of 3D points. Inner nodes split at the median of the axis with the
+// largest extent. Leaves hold up to leaf_size points, stored as AoVS Point<V> chunks that are
+// searched by brute force; unused lanes are padded with points at infinity.
+template <typename V = stdx::native_simd<float>>
+class kd_tree
+{
+  static constexpr std::uint32_t leaf_axis = 3;
+
+  struct node {
+    float split;
+    std::uint32_t axis;
+    // inner node: left and right child; leaf: range of chunks
+    std::uint32_t first, last;
+  };
+
+  std::vector<node> _nodes;
+  std::vector<Point<V>> _chunks;
+  std::vector<std::uint32_t> _indices;
+
+  static constexpr float coordinate(const Point<float>& p, std::uint32_t axis)
+  { return axis == 0 ? p.x : axis == 1 ? p.y : p.z; }
+
+  std::uint32_t build(const Point<std::vector<float>>& points, std::span<std::uint32_t> idx,
+                      std::size_t leaf_size)
+  {
+    auto point = [&](std::uint32_t i) {
+      return Point<float>{points.x[i], points.y[i], points.z[i]};
+    };
+    const auto self = std::uint32_t(_nodes.size());
+    _nodes.emplace_back();
+    if (idx.size() <= leaf_size) {
+      const auto first = std::uint32_t(_chunks.size());
+      for (std::size_t i = 0; i < idx.size(); i += V::size()) {
+        auto lane = [&](auto get) {
+          return V([&](auto j) {
+            return i + j < idx.size() ? get(point(idx[i + j]))
+                                      : std::numeric_limits<float>::infinity();
+          });
+        };
+        _chunks.push_back({lane([](auto p) { return p.x; }), lane([](auto p) { return p.y; }),
+                           lane([](auto p) { return p.z; })});
+        for (std::size_t j = 0; j < V::size(); ++j) {
+          _indices.push_back(i + j < idx.size() ? idx[i + j] : 0);
+        }
+      }
+      _nodes[self] = {0.f, leaf_axis, first, std::uint32_t(_chunks.size())};
+      return self;
+    }
+    Point<float> lo = point(idx[0]), hi = lo;
+    for (std::uint32_t i : idx) {
+      const auto p = point(i);
+      lo = {std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z)};
+      hi = {std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z)};
+    }
+    const Point<float> extent = {hi.x - lo.x, hi.y - lo.y, hi.z - lo.z};
+    const std::uint32_t axis = extent.x >= extent.y and extent.x >= extent.z ? 0
+                               : extent.y >= extent.z                        ? 1
+                                                                             : 2;
+    const auto mid = idx.begin() + idx.size() / 2;
+    std::ranges::nth_element(idx, mid, {}, [&](auto i) { return coordinate(point(i), axis); });
+    const float split = coordinate(point(*mid), axis);
+    const auto left = build(points, {idx.begin(), mid}, leaf_size);
+    const auto right = build(points, {mid, idx.end()}, leaf_size);
+    _nodes[self] = {split, axis, left, right};
+    return self;
+  }
+
+  void search(std::uint32_t n, const Point<float> to_find, nearest_result& best) const
+  {
+    const node& nd = _nodes[n];
+    if (nd.axis == leaf_axis) {
+      for (std::uint32_t c = nd.first; c < nd.last; ++c) {
+        const V d = distance(_chunks[c], to_find);
+        const auto closer = d < best.distance;
+        if (any_of(closer)) {
+          for (std::size_t j = 0; j < V::size(); ++j) {
+            if (closer[j]) {
+              best = min(best, {d[j], _indices[c * V::size() + j]});
+            }
+          }
+        }
+      }
+      return;
+    }
+    const float delta = coordinate(to_find, nd.axis) - nd.split;
+    search(delta < 0 ? nd.first : nd.last, to_find, best);
+    if (delta * delta < best.distance) {
+      search(delta < 0 ? nd.last : nd.first, to_find, best);
+    }
+  }
+
+public:
+  explicit kd_tree(const Point<std::vector<float>>& points, std::size_t leaf_size = 4 * V::size())
+  {
+    std::vector<std::uint32_t> idx(points.x.size());
+    std::iota(idx.begin(), idx.end(), 0u);
+    if (not idx.empty()) {
+      build(points, idx, leaf_size);
+    }
+  }
+
+  std::size_t index_of_nearest(const Point<float> to_find) const
+  {
+    nearest_result best;
+    if (not _nodes.empty()) {
+      search(0, to_find, best);
+    }
+    return best.index;
+  }
+
+  std::size_t memory_bytes() const
+  {
+    return _nodes.size() * sizeof(node) + _chunks.size() * sizeof(Point<V>) +
+           _indices.size() * sizeof(std::uint32_t);
+  }
+};
+
+#endif // NEAREST_NEIGHBOR_H
@@ -5,6 +5,7 @@
 #include <iostream>
 
 #include "benchmark.h"
+#include "data_generation.h"
 
 void fail(auto&&... info) {
   (std::cerr << ... << info) << '\n';
@@ -19,17 +20,32 @@ std::random_device rd;
 std::mt19937 gen(rd());
 std::uniform_real_distribution<float> rnd0_10(0.f, 10.f);
 
+// Values in [0, 10] where the matches of pattern are closer to 0 than all values before them
+// (i.e. they take the `d < best` branch of the scalar search) and all other values are not.
+std::vector<float> make_patterned_data(std::size_t n, data_pattern pattern)
+{
+  std::size_t improvements = 0;
+  pattern.generate(n, [&](bool match) { improvements += match; });
+  std::vector<float> data;
+  data.reserve(n);
+  float best = 10.f;
+  std::size_t k = 0;
+  pattern.generate(n, [&](bool match) {
+    if (match) {
+      best = 10. * (improvements - k++) / (improvements + 1);
+      data.push_back(best);
+    } else {
+      data.push_back(std::uniform_real_distribution<float>(best, 10.f)(gen));
+    }
+  });
+  return data;
+}
+
 template <typename T>
-void linear_search(benchmark::State& state)
+void search_benchmark(benchmark::State& state, const std::vector<float>& data, float to_find)
 {
-  const std::size_t n = state.range(0);
+  const std::size_t n = data.size();
   assert(n % floatv::size() == 0);
-  std::vector<float> data(n);
-  for (auto& x : data) {
-    x = rnd0_10(gen);
-  }
-  const float to_find = rnd0_10(gen);
-
   std::size_t idx = 0;
   for (auto _ : state) {
     float best = std::numeric_limits<float>::max();
@@ -65,12 +81,37 @@ void linear_search(benchmark::State& state)
   }
 }
 
+template <typename T>
+void linear_search(benchmark::State& state)
+{
+  std::vector<float> data(state.range(0));
+  for (auto& x : data) {
+    x = rnd0_10(gen);
+  }
+  search_benchmark<T>(state, data, rnd0_10(gen));
+}
+
 template <typename T>
 [[gnu::optimize("-O3")]] void linear_search_O3(benchmark::State& state)
 {
   linear_search<T>(state);
 }
 
+// selectivity = fraction of the values that improve on the best distance so far
+template <typename T>
+void linear_search_patterned(benchmark::State& state)
+{
+  search_benchmark<T>(state, make_patterned_data(state.range(0), pattern_from_args(state)), 0.f);
+}
+
+template <typename T>
+[[gnu::optimize("-O3")]] void linear_search_patterned_O3(benchmark::State& state)
+{
+  linear_search_patterned<T>(state);
+}
+
+static void PatternRange(benchmark::internal::Benchmark* b) { pattern_args(b, {1 << 12, 1 << 20}); }
+
 constexpr std::size_t smallest = 1 << 6;
 constexpr auto largest = 1 << 23;
 
@@ -79,3 +120,6 @@ constexpr auto largest = 1 << 23;
 BENCHMARK(linear_search<float>)->MYRANGE;
 BENCHMARK(linear_search<floatv>)->MYRANGE;
 BENCHMARK(linear_search_O3<float>)->MYRANGE;
+BENCHMARK(linear_search_patterned<float>)->Apply(PatternRange);
+BENCHMARK(linear_search_patterned<floatv>)->Apply(PatternRange);
+BENCHMARK(linear_search_patterned_O3<float>)->Apply(PatternRange);
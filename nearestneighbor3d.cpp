@@ -7,6 +7,7 @@
 #include <iostream>
 
 #include "benchmark.h"
+#include "nearest_neighbor.h"
 
 void fail(auto&&... info) {
   (std::cerr << ... << info) << '\n';
@@ -21,17 +22,6 @@ std::random_device rd;
 std::mt19937 gen(rd());
 std::uniform_real_distribution<float> rnd0_10(0.f, 10.f);
 
-template <typename T> struct Point {
-  T x, y, z;
-};
-
-template <typename T> constexpr T sqr(T x) { return x * x; }
-
-template <typename T, typename U> constexpr auto distance(Point<T> a, Point<U> b)
-{
-  return sqr(a.x - b.x) + sqr(a.y - b.y) + sqr(a.z - b.z);
-}
-
 template <typename T>
 T generate_random_points(std::size_t n) {
   if constexpr (std::same_as<T, Point<std::vector<float>>>) {
@@ -156,6 +146,20 @@ void verify(const std::vector<Point<T>>& points, const Point<float> to_find,
   }
 }
 
+void verify(const Point<std::vector<float>>& points, const Point<float> to_find,
+            const std::size_t idx)
+{
+  auto&& d = [&](std::size_t i) {
+    return distance(Point<float>{points.x[i], points.y[i], points.z[i]}, to_find);
+  };
+  const auto best = d(idx);
+  for (std::size_t i = 0; i < points.x.size(); ++i) {
+    if (d(i) < best) {
+      fail("wrong");
+    }
+  }
+}
+
 template <typename T>
 void soa(benchmark::State& state)
 {
@@ -211,6 +215,122 @@ void aovs(benchmark::State& state)
   verify(points, to_find, idx, n);
 }
 
+template <int Threads>
+void soa_parallel(benchmark::State& state)
+{
+  const std::size_t n = state.range(0);
+  const auto points = generate_random_points<Point<std::vector<float>>>(n);
+  Point<float> to_find = {rnd0_10(gen), rnd0_10(gen), rnd0_10(gen)};
+  std::size_t idx = 0;
+  for (auto _ : state) {
+    vir::fake_modify(to_find.x);
+    vir::fake_read(idx = index_of_nearest_parallel(points, to_find, Threads));
+  }
+  state.SetBytesProcessed(state.iterations() * 3 * n * sizeof(float));
+  verify(points, to_find, idx);
+}
+
+void kd_tree_build(benchmark::State& state)
+{
+  const std::size_t n = state.range(0);
+  const auto points = generate_random_points<Point<std::vector<float>>>(n);
+  std::size_t bytes = 0;
+  for (auto _ : state) {
+    kd_tree tree(points);
+    vir::fake_read(bytes = tree.memory_bytes());
+  }
+  state.counters["memory / Byte"] = bytes;
+  state.counters["memory / (Byte per point)"] = double(bytes) / n;
+}
+
+// Cycles through 1024 random queries, so the time per iteration is the average query latency.
+// Unlike the brute-force benchmarks, which repeat a single query, the tree descent thus does not
+// take the same path every iteration.
+void kd_tree_query(benchmark::State& state)
+{
+  const std::size_t n = state.range(0);
+  const auto points = generate_random_points<Point<std::vector<float>>>(n);
+  const kd_tree tree(points);
+  std::vector<Point<float>> queries(1024);
+  std::generate(queries.begin(), queries.end(), []() {
+    return Point<float>{rnd0_10(gen), rnd0_10(gen), rnd0_10(gen)};
+  });
+  // against brute force, which may pick a different one of several equally near points
+  for (const Point<float>& query : queries) {
+    const std::size_t idx = tree.index_of_nearest(query);
+    const std::size_t expected = index_of_nearest<floatv>(points, query);
+    auto&& d = [&](std::size_t i) {
+      return distance(Point<float>{points.x[i], points.y[i], points.z[i]}, query);
+    };
+    if (d(idx) != d(expected)) {
+      fail("wrong: found ", idx, " at distance ", d(idx), " instead of ", expected,
+           " at distance ", d(expected));
+    }
+  }
+  std::size_t q = 0;
+  for (auto _ : state) {
+    q = (q + 1) % queries.size();
+    vir::fake_read(tree.index_of_nearest(queries[q]));
+  }
+}
+
+// checks that idx holds the k nearest points, in order
+void verify_k(const Point<std::vector<float>>& points, const Point<float> to_find,
+              std::span<const std::size_t> idx)
+{
+  auto&& d = [&](std::size_t i) {
+    return distance(Point<float>{points.x[i], points.y[i], points.z[i]}, to_find);
+  };
+  std::vector<float> all(points.x.size());
+  for (std::size_t i = 0; i < all.size(); ++i) {
+    all[i] = d(i);
+  }
+  std::ranges::partial_sort(all, all.begin() + idx.size());
+  for (std::size_t j = 0; j < idx.size(); ++j) {
+    if (d(idx[j]) != all[j]) {
+      fail("wrong: ", j, "-th nearest has distance ", d(idx[j]), " instead of ", all[j]);
+    }
+  }
+}
+
+// Q = state.range(0) queries for the k = state.range(1) nearest of 2^20 points
+template <std::size_t QueryBlock>
+void knn_batched(benchmark::State& state)
+{
+  constexpr std::size_t n = 1 << 20;
+  const std::size_t n_queries = state.range(0);
+  const std::size_t k = state.range(1);
+  const auto points = generate_random_points<Point<std::vector<float>>>(n);
+  std::vector<Point<float>> queries(n_queries);
+  std::generate(queries.begin(), queries.end(), []() {
+    return Point<float>{rnd0_10(gen), rnd0_10(gen), rnd0_10(gen)};
+  });
+  // every query, since a blocking error may only show in a later block
+  const std::vector<std::size_t> expected = k_nearest_batched(points, queries, k, QueryBlock);
+  for (std::size_t q = 0; q < n_queries; ++q) {
+    verify_k(points, queries[q], std::span(expected).subspan(q * k, k));
+  }
+  std::vector<std::size_t> idx;
+  for (auto _ : state) {
+    idx = k_nearest_batched(points, queries, k, QueryBlock);
+    vir::fake_read(idx.data());
+  }
+  state.counters["queries/s"] = {double(n_queries), benchmark::Counter::kIsIterationInvariantRate};
+  // Model, not a measurement: every block of QueryBlock queries streams the coordinates of all
+  // points once. The top-k state (and its spills for large k) is not included.
+  state.counters["streamed bytes per query (model)"] =
+      3. * n * sizeof(float) * ((n_queries + QueryBlock - 1) / QueryBlock) / n_queries;
+}
+
+static void KnnRange(benchmark::internal::Benchmark* b)
+{
+  for (long q : {1, 16, 256}) {
+    for (long k : {1, 8, 32}) {
+      b->Args({q, k});
+    }
+  }
+}
+
 constexpr std::size_t smallest = 1 << 6;
 constexpr auto largest = 1 << 23;
 
@@ -223,3 +343,13 @@ BENCHMARK(soa<float>)->MYRANGE;
 BENCHMARK(soa_O3<float>)->MYRANGE;
 BENCHMARK(soa<floatv>)->MYRANGE;
 BENCHMARK(aovs<floatv>)->MYRANGE;
+BENCHMARK(soa_parallel<1>)->MYRANGE->UseRealTime();
+BENCHMARK(soa_parallel<2>)->MYRANGE->UseRealTime();
+BENCHMARK(soa_parallel<4>)->MYRANGE->UseRealTime();
+BENCHMARK(soa_parallel<8>)->MYRANGE->UseRealTime();
+BENCHMARK(soa_parallel<16>)->MYRANGE->UseRealTime();
+BENCHMARK(knn_batched<1>)->Apply(KnnRange);
+BENCHMARK(knn_batched<16>)->Apply(KnnRange);
+BENCHMARK(knn_batched<64>)->Apply(KnnRange);
+BENCHMARK(kd_tree_build)->MYRANGE;
+BENCHMARK(kd_tree_query)->MYRANGE;
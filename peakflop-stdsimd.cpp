@@ -16,6 +16,7 @@ void peak(benchmark::State &state)
   constexpr int N = 1;
   V x = {};
   asm("" : "+m"(x));
+  perf_scope perf;
   for (auto _ : state) {
     x = x * 3.f + 1.f;
   }
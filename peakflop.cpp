@@ -12,10 +12,9 @@ void peak(benchmark::State &state)
   for (auto& v : x) {
     vir::fake_modify(v);
   }
+  perf_scope perf;
   for (auto _ : state) {
-    for (auto& v : x) {
-      v = v * 3 + 1;
-    }
+    peak_flop_step(x);
   }
   for (auto& v : x) {
     vir::fake_read(v);
@@ -26,3 +25,74 @@ void peak(benchmark::State &state)
 
 // Register the function as a benchmark
 BENCHMARK(peak);
+
+// Peak suite: N independent accumulators (1-16) expose the latency (N = 1) and the throughput
+// (N >= latency * ports) of add, mul, FMA, and of a mix of the three that loads several ports.
+// For integral types "FLOP" counts integer operations.
+enum class peak_op { add, mul, fma, mixed };
+
+template <peak_op Op, typename V, int N>
+void peak_accumulators(benchmark::State &state)
+{
+  V x[N] = {};
+  // hidden from the compiler, so that no operation can be folded away; 1 and 0 keep the values
+  // finite for floating-point and free of overflow for integers
+  V a = 1;
+  V b = 0;
+  for (auto& v : x) {
+    vir::fake_modify(v);
+  }
+  vir::fake_modify(a);
+  vir::fake_modify(b);
+  perf_scope perf;
+  for (auto _ : state) {
+#pragma GCC unroll 16
+    for (int i = 0; i < N; ++i) {
+      auto& v = x[i];
+      const peak_op op = Op == peak_op::mixed ? peak_op(i % 3) : Op;
+      if (op == peak_op::add)
+        v = v + b;
+      else if (op == peak_op::mul)
+        v = v * a;
+      else
+        v = v * a + b;
+      // keeps every accumulator in its own register (no SLP vectorization of scalar chains)
+      vir::fake_modify(v);
+    }
+  }
+  for (auto& v : x) {
+    vir::fake_read(v);
+  }
+  int flop = 0;
+  for (int i = 0; i < N; ++i) {
+    const peak_op op = Op == peak_op::mixed ? peak_op(i % 3) : Op;
+    flop += op == peak_op::fma ? 2 : 1;
+  }
+  add_flop_counters<element_type_t<V>>(state, flop * element_count<V>::value);
+}
+
+// state.range(0) selects the number of accumulators
+template <peak_op Op, typename V>
+void peak_suite(benchmark::State &state)
+{
+  [&]<int... Is>(std::integer_sequence<int, Is...>) {
+    ((state.range(0) == Is + 1 ? peak_accumulators<Op, V, Is + 1>(state) : void()), ...);
+  }(std::make_integer_sequence<int, 16>());
+}
+
+template <typename V> void peak_add(benchmark::State &state) { peak_suite<peak_op::add, V>(state); }
+template <typename V> void peak_mul(benchmark::State &state) { peak_suite<peak_op::mul, V>(state); }
+template <typename V> void peak_fma(benchmark::State &state) { peak_suite<peak_op::fma, V>(state); }
+template <typename V> void peak_mixed(benchmark::State &state) { peak_suite<peak_op::mixed, V>(state); }
+
+using peak_types = concat<all_simds_of<float>, all_simds_of<double>, all_simds_of<int>,
+                          all_simds_of<short>>;
+
+static void
+Accumulators(benchmark::internal::Benchmark* b)
+{ b->ArgName("accumulators")->DenseRange(1, 16); }
+
+SIMD_BENCHMARK_TEMPLATE(peak_add, peak_types)->Apply(Accumulators);
+SIMD_BENCHMARK_TEMPLATE(peak_mul, peak_types)->Apply(Accumulators);
+SIMD_BENCHMARK_TEMPLATE(peak_fma, peak_types)->Apply(Accumulators);
+SIMD_BENCHMARK_TEMPLATE(peak_mixed, peak_types)->Apply(Accumulators);
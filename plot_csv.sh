@@ -6,7 +6,7 @@
 has_size=false
 if (($# >= 1)) && [[ -f "$1" ]]; then
   firstdata="$(grep '^"' "$1"|head -n1)"
-  if [[ ${firstdata%%,*} =~ '/[0-9]+"$' ]]; then
+  if [[ ${firstdata%%,*} =~ '/[0-9]+(/threads:[0-9]+)?(/iterations:1/manual_time)?"$' ]]; then
     has_size=true
   fi
   typeset -A columns_idx_for_name
@@ -134,7 +134,8 @@ last_title=
 last_size=0
 ngroups=-1
 grep '^"' "$1" \
-  | sed -e 's,/\([0-9]\+\)","\,\1,' \
+  | sed -e 's,/iterations:1/manual_time",",' \
+        -e 's,/\([0-9]\+\)\(/threads:[0-9]\+\)\?",\2"\,\1,' \
         -e 's,_, ,g' \
         -e 's,<decltype(vir::execution::simd\.\?\(.*\))>, \1,' \
         -e 's,()\., ,g' \
@@ -11,6 +11,7 @@ iterator_ctor(benchmark::State &state)
 {
   using V = std::simd<float>;
   std::vector<float> data(state.range(0), 1.f);
+  perf_scope perf;
   for (auto _ : state) {
     auto it = data.begin();
     auto end = data.end() - V::size();
@@ -32,6 +33,7 @@ naive_range_ctor(benchmark::State &state)
 {
   using V = std::simd<float>;
   std::vector<float> data(state.range(0), 1.f);
+  perf_scope perf;
   for (auto _ : state) {
     const auto end = data.end();
     for (auto it = data.begin(); it < end; it += V::size())
@@ -49,6 +51,7 @@ smart_range_ctor(benchmark::State &state)
 {
   using V = std::simd<float>;
   std::vector<float> data(state.range(0), 1.f);
+  perf_scope perf;
   for (auto _ : state) {
     auto it = data.begin();
     const auto end = data.end();
@@ -2,9 +2,30 @@
 /* Copyright © 2023 GSI Helmholtzzentrum fuer Schwerionenforschung GmbH
  *                  Matthias Kretz <m.kretz@gsi.de>
  */
+#ifndef SIMD_FOR_EACH_H
+#define SIMD_FOR_EACH_H
+
 #include <vir/simd.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <mutex>
 #include <ranges>
+#include <span>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#if defined __x86_64__ || defined __i386__
+#include <immintrin.h>
+#endif
 
 namespace stdx = vir::stdx;
 
@@ -16,19 +37,71 @@ template <typename T> auto data_or_ptr(T&& r) -> decltype(std::ranges::data(r))
 template <typename T> T* data_or_ptr(T* ptr) { return ptr; }
 template <typename T> const T* data_or_ptr(const T* ptr) { return ptr; }
 
+inline constexpr std::size_t simd_cache_line_size = 64;
+
+// Prefetches the cache lines covering [ptr, ptr + bytes) shifted by distance cache lines.
+template <int distance, bool for_write, std::size_t bytes>
+void simd_prefetch(const void* ptr)
+{
+  const char* ahead = static_cast<const char*>(ptr) + distance * simd_cache_line_size;
+  for (std::size_t offset = 0; offset < bytes; offset += simd_cache_line_size) {
+    __builtin_prefetch(ahead + offset, for_write);
+  }
+}
+
+// Load/store flag for simd_invoke: loads are vector aligned, write back uses non-temporal
+// stores. Needs a simd_stream_fence() after the last store.
+struct simd_streaming_tag {
+};
+
+// Stores v to the vector aligned ptr, bypassing the cache if the target supports it.
+template <typename V> void simd_stream_to(const V& v, typename V::value_type* ptr)
+{
+#if defined __AVX512F__
+  if constexpr (sizeof(V) == 64) {
+    _mm512_stream_si512(reinterpret_cast<__m512i*>(ptr), std::bit_cast<__m512i>(v));
+    return;
+  }
+#endif
+#if defined __AVX__
+  if constexpr (sizeof(V) == 32) {
+    _mm256_stream_si256(reinterpret_cast<__m256i*>(ptr), std::bit_cast<__m256i>(v));
+    return;
+  }
+#endif
+#if defined __SSE2__
+  if constexpr (sizeof(V) == 16) {
+    _mm_stream_si128(reinterpret_cast<__m128i*>(ptr), std::bit_cast<__m128i>(v));
+    return;
+  }
+#endif
+  v.copy_to(ptr, stdx::vector_aligned);
+}
+
+inline void simd_stream_fence()
+{
+#if defined __SSE__
+  _mm_sfence();
+#endif
+}
+
 // Invokes fun(V&) or fun(const V&) with V copied from r at offset i.
 // If write_back is true, copy it back to r.
 template <typename V, bool write_back, typename Flags, std::size_t... Is>
 constexpr void simd_invoke(auto&& fun, auto&& r, std::size_t i, Flags f,
                            std::index_sequence<Is...>)
 {
+  constexpr bool streaming = std::same_as<Flags, simd_streaming_tag>;
+  using LoadFlags = std::conditional_t<streaming, stdx::vector_aligned_tag, Flags>;
   [&](auto... chunks) {
     std::invoke(fun, chunks...);
-    if constexpr (write_back) {
+    if constexpr (write_back and streaming) {
+      (simd_stream_to(chunks, data_or_ptr(r) + i + (V::size() * Is)), ...);
+    } else if constexpr (write_back) {
       (chunks.copy_to(data_or_ptr(r) + i + (V::size() * Is), f), ...);
     }
   }(std::conditional_t<write_back, V, const V>(data_or_ptr(r) + i + (V::size() * Is),
-                                               f)...);
+                                               LoadFlags())...);
 }
 
 template <class V, bool write_back, std::size_t max_bytes>
@@ -45,6 +118,23 @@ constexpr void simd_for_each_prologue(auto&& fun, auto ptr, std::size_t to_proce
   }
 }
 
+// Invokes fun(V&) or fun(const V&) once for the elements [i, size(rng)), which must be less
+// than V::size(). Only the valid lanes are loaded and written back.
+template <class V, bool write_back>
+constexpr void simd_for_each_masked_epilogue(auto&& fun, auto&& rng, std::size_t i, auto f)
+{
+  using T = typename V::value_type;
+  const auto mask = V([](auto j) { return T(j); }) < T(std::ranges::size(rng) - i);
+  V chunk{};
+  where(mask, chunk).copy_from(std::ranges::data(rng) + i, f);
+  if constexpr (write_back) {
+    std::invoke(fun, chunk);
+    where(mask, chunk).copy_to(std::ranges::data(rng) + i, f);
+  } else {
+    std::invoke(fun, std::as_const(chunk));
+  }
+}
+
 template <class V0, bool write_back>
 constexpr void simd_for_each_epilogue(auto&& fun, auto&& rng, std::size_t i, auto f)
 {
@@ -63,6 +153,15 @@ namespace execution
 inline constexpr struct simd_policy_prefer_aligned_t {
 } simd_policy_prefer_aligned{};
 
+inline constexpr struct simd_policy_streaming_stores_t {
+} simd_policy_streaming_stores{};
+
+inline constexpr struct simd_policy_pairwise_reduction_t {
+} simd_policy_pairwise_reduction{};
+
+inline constexpr struct simd_policy_masked_epilogue_t {
+} simd_policy_masked_epilogue{};
+
 template <int N>
   requires(N > 1)
 struct simd_policy_unroll_by_t : std::integral_constant<int, N> {
@@ -78,6 +177,36 @@ struct is_simd_policy_unroll_by<const simd_policy_unroll_by_t<N>>
     : std::integral_constant<int, N> {
 };
 
+template <int N>
+  requires(N > 1)
+struct simd_policy_parallel_t : std::integral_constant<int, N> {
+};
+
+template <int N> inline constexpr simd_policy_parallel_t<N> simd_policy_parallel{};
+
+template <typename T> struct is_simd_policy_parallel : std::integral_constant<int, 0> {
+};
+
+template <int N>
+struct is_simd_policy_parallel<const simd_policy_parallel_t<N>>
+    : std::integral_constant<int, N> {
+};
+
+template <int N>
+  requires(N > 0)
+struct simd_policy_prefetch_t : std::integral_constant<int, N> {
+};
+
+template <int N> inline constexpr simd_policy_prefetch_t<N> simd_policy_prefetch{};
+
+template <typename T> struct is_simd_policy_prefetch : std::integral_constant<int, 0> {
+};
+
+template <int N>
+struct is_simd_policy_prefetch<const simd_policy_prefetch_t<N>>
+    : std::integral_constant<int, N> {
+};
+
 template <auto... Options> struct simd_policy {
   static constexpr bool _prefers_aligned =
       (false or ... or std::same_as<decltype(Options), const simd_policy_prefer_aligned_t>);
@@ -85,6 +214,21 @@ template <auto... Options> struct simd_policy {
   static constexpr int _unroll_by =
       (0 + ... + is_simd_policy_unroll_by<decltype(Options)>::value);
 
+  static constexpr int _threads = (0 + ... + is_simd_policy_parallel<decltype(Options)>::value);
+
+  static constexpr bool _streaming_stores =
+      (false or ... or std::same_as<decltype(Options), const simd_policy_streaming_stores_t>);
+
+  static constexpr int _prefetch_distance =
+      (0 + ... + is_simd_policy_prefetch<decltype(Options)>::value);
+
+  static constexpr bool _pairwise_reduction =
+      (false or ... or
+       std::same_as<decltype(Options), const simd_policy_pairwise_reduction_t>);
+
+  static constexpr bool _masked_epilogue =
+      (false or ... or std::same_as<decltype(Options), const simd_policy_masked_epilogue_t>);
+
   static constexpr simd_policy<Options..., simd_policy_prefer_aligned> prefer_aligned()
     requires(not _prefers_aligned)
   { return {}; }
@@ -93,6 +237,35 @@ template <auto... Options> struct simd_policy {
   static constexpr simd_policy<Options..., simd_policy_unroll_by<N>> unroll_by()
     requires(_unroll_by == 0)
   { return {}; }
+
+  template <int N>
+  static constexpr simd_policy<Options..., simd_policy_parallel<N>> parallel()
+    requires(_threads == 0)
+  { return {}; }
+
+  // Write back with non-temporal stores in the main loop. Implies an aligned main loop.
+  static constexpr simd_policy<Options..., simd_policy_streaming_stores> streaming_stores()
+    requires(not _streaming_stores)
+  { return {}; }
+
+  // Prefetch Distance cache lines ahead of the main loop.
+  template <int Distance>
+  static constexpr simd_policy<Options..., simd_policy_prefetch<Distance>> prefetch()
+    requires(_prefetch_distance == 0)
+  { return {}; }
+
+  // Reductions combine accumulators and lanes in a fixed binary tree and skip the alignment
+  // prologue, so that the result does not depend on the address of the data.
+  static constexpr simd_policy<Options..., simd_policy_pairwise_reduction>
+  pairwise_reduction()
+    requires(not _pairwise_reduction)
+  { return {}; }
+
+  // for_each handles the remainder with one masked load and store instead of the recursive
+  // halving epilogue. fun sees value-initialized values in the inactive lanes.
+  static constexpr simd_policy<Options..., simd_policy_masked_epilogue> masked_epilogue()
+    requires(not _masked_epilogue)
+  { return {}; }
 };
 
 inline constexpr simd_policy<> simd {};
@@ -105,22 +278,31 @@ struct is_simd_policy<simd_policy<Options...>> : std::true_type {
 };
 }
 
-template <typename ExecutionPolicy, std::ranges::contiguous_range R, typename F>
-  requires execution::is_simd_policy<ExecutionPolicy>::value
-constexpr void for_each(ExecutionPolicy, R&& rng, F&& fun)
+// Runs the prologue, the (unrolled) main loop and the epilogue over the contiguous range rng.
+template <typename ExecutionPolicy, typename V, bool write_back>
+constexpr void simd_for_each_serial(auto&& rng, auto&& fun)
 {
-  using V = stdx::native_simd<std::ranges::range_value_t<R>>;
-  constexpr bool write_back = std::ranges::output_range<R, typename V::value_type> and
-                              std::invocable<F, V&> and not std::invocable<F, V&&>;
   std::size_t i = 0;
-  constexpr std::conditional_t<ExecutionPolicy::_prefers_aligned, stdx::vector_aligned_tag,
-                               stdx::element_aligned_tag>
+  constexpr bool aligned = ExecutionPolicy::_prefers_aligned or ExecutionPolicy::_streaming_stores;
+  constexpr bool streaming = write_back and ExecutionPolicy::_streaming_stores;
+  constexpr std::conditional_t<aligned, stdx::vector_aligned_tag, stdx::element_aligned_tag>
       flags{};
-  if constexpr (ExecutionPolicy::_prefers_aligned) {
+  constexpr std::conditional_t<streaming, simd_streaming_tag, decltype(flags)> main_flags{};
+  if constexpr (aligned) {
     const auto misaligned_by = reinterpret_cast<std::uintptr_t>(std::ranges::data(rng)) %
                                stdx::memory_alignment_v<V>;
     if (misaligned_by != 0) {
-      const auto to_process = stdx::memory_alignment_v<V> - misaligned_by;
+      const std::size_t to_process =
+          (stdx::memory_alignment_v<V> - misaligned_by) / sizeof(typename V::value_type);
+      if (to_process >= std::ranges::size(rng)) {
+        // too short to ever reach an aligned address
+        if constexpr (ExecutionPolicy::_masked_epilogue) {
+          simd_for_each_masked_epilogue<V, write_back>(fun, rng, 0, stdx::element_aligned);
+        } else {
+          simd_for_each_epilogue<V, write_back>(fun, rng, 0, stdx::element_aligned);
+        }
+        return;
+      }
       simd_for_each_prologue<stdx::resize_simd_t<1, V>, write_back,
                              stdx::memory_alignment_v<V>>(fun, std::ranges::data(rng),
                                                           to_process);
@@ -130,12 +312,574 @@ constexpr void for_each(ExecutionPolicy, R&& rng, F&& fun)
   if constexpr (ExecutionPolicy::_unroll_by > 1) {
     for (; i + V::size() * ExecutionPolicy::_unroll_by <= std::ranges::size(rng);
          i += V::size() * ExecutionPolicy::_unroll_by) {
-      simd_invoke<V, write_back>(fun, rng, i, flags,
+      if constexpr (ExecutionPolicy::_prefetch_distance > 0) {
+        simd_prefetch<ExecutionPolicy::_prefetch_distance, write_back,
+                      sizeof(V) * ExecutionPolicy::_unroll_by>(std::ranges::data(rng) + i);
+      }
+      simd_invoke<V, write_back>(fun, rng, i, main_flags,
                                  std::make_index_sequence<ExecutionPolicy::_unroll_by>());
     }
   }
   for (; i + V::size() <= std::ranges::size(rng); i += V::size()) {
-    simd_invoke<V, write_back>(fun, rng, i, flags, std::make_index_sequence<1>());
+    if constexpr (ExecutionPolicy::_prefetch_distance > 0 and ExecutionPolicy::_unroll_by <= 1) {
+      simd_prefetch<ExecutionPolicy::_prefetch_distance, write_back, sizeof(V)>(
+          std::ranges::data(rng) + i);
+    }
+    simd_invoke<V, write_back>(fun, rng, i, main_flags, std::make_index_sequence<1>());
+  }
+  if constexpr (streaming) {
+    simd_stream_fence();
+  }
+  if constexpr (ExecutionPolicy::_masked_epilogue) {
+    if (i < std::ranges::size(rng)) {
+      simd_for_each_masked_epilogue<V, write_back>(fun, rng, i, flags);
+    }
+  } else {
+    simd_for_each_epilogue<V, write_back>(fun, rng, i, flags);
+  }
+}
+
+// Ranges smaller than two chunks of this size are not worth waking up the thread pool.
+inline constexpr std::size_t simd_parallel_min_chunk_bytes = 4096;
+
+// Persistent worker threads for simd_policy::parallel<N>(). run(n, job) executes job on n
+// pool threads and on the calling thread, and returns once all of them are done. An exception
+// thrown by job is rethrown by run after all threads are done. run called from within a job
+// (e.g. a parallel<N> algorithm inside a chunk of simd_parallel_chunks) executes job on the
+// calling thread only, since the pool threads are busy with the outer job.
+class simd_thread_pool
+{
+  std::mutex _run_mutex;
+  std::mutex _mutex;
+  std::condition_variable_any _wake;
+  std::condition_variable _done;
+  std::function<void()> _job;
+  std::exception_ptr _exception;
+  std::size_t _generation = 0;
+  int _requested = 0;
+  int _pending = 0;
+  std::vector<std::jthread> _workers;
+  static inline thread_local bool _in_job = false;
+
+  void run_job() noexcept
+  {
+    try {
+      _job();
+    } catch (...) {
+      std::scoped_lock lock(_mutex);
+      if (not _exception)
+        _exception = std::current_exception();
+    }
+  }
+
+  void worker_loop(std::stop_token stop, int id, std::size_t seen)
+  {
+    _in_job = true;
+    std::unique_lock lock(_mutex);
+    while (_wake.wait(lock, stop, [&] { return _generation != seen; })) {
+      seen = _generation;
+      if (id >= _requested)
+        continue;
+      lock.unlock();
+      run_job();
+      lock.lock();
+      if (--_pending == 0)
+        _done.notify_one();
+    }
+  }
+
+public:
+  static simd_thread_pool& instance()
+  {
+    static simd_thread_pool pool;
+    return pool;
+  }
+
+  void run(int n, std::function<void()> job)
+  {
+    if (_in_job) {
+      job();
+      return;
+    }
+    std::scoped_lock serialize(_run_mutex);
+    {
+      std::scoped_lock lock(_mutex);
+      while (int(_workers.size()) < n) {
+        _workers.emplace_back([this, id = int(_workers.size()), seen = _generation](
+                                  std::stop_token stop) { worker_loop(stop, id, seen); });
+      }
+      _job = std::move(job);
+      _exception = nullptr;
+      _requested = n;
+      _pending = n;
+      ++_generation;
+    }
+    _wake.notify_all();
+    _in_job = true;
+    run_job();
+    _in_job = false;
+    std::unique_lock lock(_mutex);
+    _done.wait(lock, [&] { return _pending == 0; });
+    if (_exception)
+      std::rethrow_exception(std::exchange(_exception, nullptr));
+  }
+};
+
+// Splits all into chunks that start on a cache line boundary and lets `threads` workers
+// (including the calling thread) pull chunks off a shared counter until all are done.
+// chunk_fun(worker, chunk) is called for every chunk, where worker in [0, threads) identifies
+// the calling thread. Only the first chunk can start misaligned.
+template <typename T> void simd_parallel_chunks(std::span<T> all, int threads, auto&& chunk_fun)
+{
+  constexpr std::size_t line = simd_cache_line_size / sizeof(T);
+  constexpr std::size_t min_chunk = simd_parallel_min_chunk_bytes / sizeof(T);
+  if (all.size() < 2 * min_chunk) {
+    chunk_fun(0, all);
+    return;
+  }
+  const std::size_t head = (simd_cache_line_size - reinterpret_cast<std::uintptr_t>(all.data()) %
+                                                       simd_cache_line_size) %
+                           simd_cache_line_size / sizeof(T);
+  const std::size_t chunk =
+      (std::max(min_chunk, all.size() / (8 * threads)) + line - 1) / line * line;
+  const std::size_t n_chunks = (all.size() - head + chunk - 1) / chunk;
+  std::atomic<std::size_t> next_chunk = 0;
+  std::atomic<int> next_worker = 0;
+  simd_thread_pool::instance().run(threads - 1, [&] {
+    const int worker = next_worker++;
+    for (std::size_t c = next_chunk++; c < n_chunks; c = next_chunk++) {
+      const std::size_t first = c == 0 ? 0 : head + c * chunk;
+      const std::size_t last = std::min(head + (c + 1) * chunk, all.size());
+      chunk_fun(worker, all.subspan(first, last - first));
+    }
+  });
+}
+
+// Each chunk goes through simd_for_each_serial, so only the first chunk can need a prologue.
+template <typename ExecutionPolicy, typename V, bool write_back>
+void simd_for_each_parallel(auto&& rng, auto&& fun)
+{
+  using T = std::remove_reference_t<std::ranges::range_reference_t<decltype(rng)>>;
+  simd_parallel_chunks(std::span<T>(std::ranges::data(rng), std::ranges::size(rng)),
+                       ExecutionPolicy::_threads, [&](int, std::span<T> chunk) {
+                         simd_for_each_serial<ExecutionPolicy, V, write_back>(chunk, fun);
+                       });
+}
+
+template <typename ExecutionPolicy, std::ranges::contiguous_range R, typename F>
+  requires execution::is_simd_policy<ExecutionPolicy>::value
+constexpr void for_each(ExecutionPolicy, R&& rng, F&& fun)
+{
+  using V = stdx::native_simd<std::ranges::range_value_t<R>>;
+  constexpr bool write_back = std::ranges::output_range<R, typename V::value_type> and
+                              std::invocable<F, V&> and not std::invocable<F, V&&>;
+  if constexpr (ExecutionPolicy::_threads > 1) {
+    simd_for_each_parallel<ExecutionPolicy, V, write_back>(rng, fun);
+  } else {
+    simd_for_each_serial<ExecutionPolicy, V, write_back>(rng, fun);
+  }
+}
+
+// One range of a zipped for_each: chunks are loaded from ptr + i with Flags and, if
+// write_back is true, stored back.
+template <typename T, bool write_back, typename Flags = stdx::element_aligned_tag>
+struct simd_zip_part {
+  T* ptr;
+
+  template <typename W> using simd_type = stdx::rebind_simd_t<std::remove_const_t<T>, W>;
+
+  template <typename W>
+  constexpr std::conditional_t<write_back, simd_type<W>, const simd_type<W>>
+  load(std::size_t i) const
+  { return simd_type<W>(ptr + i, Flags()); }
+
+  constexpr void store(const auto& v, std::size_t i) const
+  {
+    if constexpr (write_back) {
+      v.copy_to(ptr + i, Flags());
+    }
+  }
+
+  template <typename W> bool is_aligned_at(std::size_t i) const
+  {
+    return reinterpret_cast<std::uintptr_t>(ptr + i) % stdx::memory_alignment_v<simd_type<W>> ==
+           0;
+  }
+
+  template <typename NewFlags> constexpr simd_zip_part<T, write_back, NewFlags> with_flags() const
+  { return {ptr}; }
+};
+
+// Invokes fun(V0&, V1&, ...) once per unrolled chunk, with the chunks of W::size() elements
+// at offset i of all parts.
+template <typename W, std::size_t... Is>
+constexpr void simd_invoke_zip(auto&& fun, std::size_t i, std::index_sequence<Is...>,
+                               const auto&... parts)
+{
+  auto invoke_at = [&](std::size_t j) {
+    [&](auto&&... chunks) {
+      std::invoke(fun, chunks...);
+      (parts.store(chunks, j), ...);
+    }(parts.template load<W>(j)...);
+  };
+  (invoke_at(i + W::size() * Is), ...);
+}
+
+// Handles the elements [i, size) with chunks of less than W0::size() elements. Also serves as
+// the prologue, which is why parts must be element aligned.
+template <typename W0>
+constexpr void simd_for_each_zip_epilogue(auto&& fun, std::size_t i, std::size_t size,
+                                          const auto&... parts)
+{
+  using W = stdx::resize_simd_t<W0::size() / 2, W0>;
+  if (i + W::size() <= size) {
+    simd_invoke_zip<W>(fun, i, std::make_index_sequence<1>(), parts...);
+    i += W::size();
+  }
+  if constexpr (W::size() > 1) {
+    simd_for_each_zip_epilogue<W>(fun, i, size, parts...);
+  }
+}
+
+// Returns the index of the first element the main loop did not process.
+template <typename ExecutionPolicy, typename V>
+constexpr std::size_t simd_for_each_zip_main(auto&& fun, std::size_t i, std::size_t size,
+                                             const auto&... parts)
+{
+  if constexpr (ExecutionPolicy::_unroll_by > 1) {
+    for (; i + V::size() * ExecutionPolicy::_unroll_by <= size;
+         i += V::size() * ExecutionPolicy::_unroll_by) {
+      simd_invoke_zip<V>(fun, i, std::make_index_sequence<ExecutionPolicy::_unroll_by>(),
+                         parts...);
+    }
+  }
+  for (; i + V::size() <= size; i += V::size()) {
+    simd_invoke_zip<V>(fun, i, std::make_index_sequence<1>(), parts...);
+  }
+  return i;
+}
+
+// Runs fun over the prologue and epilogue and main_loop(i, size, parts...) over the rest.
+// If aligned is true, the prologue aligns the lead part (the first part that is written to).
+// The other parts use aligned loads and stores in the main loop only if they happen to be
+// aligned relative to the lead part.
+template <bool aligned, typename V, std::size_t lead, std::size_t... Ks>
+constexpr void simd_for_each_zip(auto&& fun, auto&& main_loop, std::size_t size,
+                                 std::index_sequence<Ks...>, const auto&... parts)
+{
+  std::size_t i = 0;
+  if constexpr (aligned) {
+    const auto& lead_part = std::get<lead>(std::tie(parts...));
+    using LeadV = typename std::remove_cvref_t<decltype(lead_part)>::template simd_type<V>;
+    const auto misaligned_by =
+        reinterpret_cast<std::uintptr_t>(lead_part.ptr) % stdx::memory_alignment_v<LeadV>;
+    if (misaligned_by != 0) {
+      i = (stdx::memory_alignment_v<LeadV> - misaligned_by) / sizeof(typename LeadV::value_type);
+      if (i >= size) {
+        simd_for_each_zip_epilogue<V>(fun, 0, size, parts...);
+        return;
+      }
+      simd_for_each_zip_epilogue<V>(fun, 0, i, parts...);
+    }
+    if ((parts.template is_aligned_at<V>(i) and ...)) {
+      i = main_loop(i, size, parts.template with_flags<stdx::vector_aligned_tag>()...);
+    } else {
+      i = main_loop(i, size,
+                    parts.template with_flags<std::conditional_t<
+                        Ks == lead, stdx::vector_aligned_tag, stdx::element_aligned_tag>>()...);
+    }
+  } else {
+    i = main_loop(i, size, parts...);
+  }
+  simd_for_each_zip_epilogue<V>(fun, i, size, parts...);
+}
+
+// True if fun modifies its K-th argument, i.e. it cannot be called with an rvalue there.
+template <typename F, std::size_t K, typename... Vs, std::size_t... Js>
+consteval bool simd_zip_modifies(std::index_sequence<Js...>)
+{ return not std::invocable<F, std::conditional_t<Js == K, Vs&&, Vs&>...>; }
+
+template <typename ExecutionPolicy, typename F, typename... Rs>
+constexpr void simd_for_each_zip_ranges(F& fun, Rs&... rngs)
+{
+  static_assert(ExecutionPolicy::_threads == 0 and not ExecutionPolicy::_streaming_stores and
+                    ExecutionPolicy::_prefetch_distance == 0,
+                "for_each over multiple ranges only supports prefer_aligned and unroll_by");
+  using R0 = std::tuple_element_t<0, std::tuple<Rs...>>;
+  using V = stdx::native_simd<std::ranges::range_value_t<R0>>;
+  const std::size_t size = std::min({std::size_t(std::ranges::size(rngs))...});
+  [&]<std::size_t... Ks>(std::index_sequence<Ks...> seq) {
+    constexpr bool write_back[] = {
+        (std::ranges::output_range<Rs, std::ranges::range_value_t<Rs>> and
+         simd_zip_modifies<F, Ks, stdx::rebind_simd_t<std::ranges::range_value_t<Rs>, V>...>(
+             seq))...};
+    constexpr std::size_t lead = [&] {
+      for (std::size_t k = 0; k < sizeof...(Ks); ++k) {
+        if (write_back[k]) {
+          return k;
+        }
+      }
+      return std::size_t();
+    }();
+    simd_for_each_zip<ExecutionPolicy::_prefers_aligned, V, lead>(
+        fun,
+        [&](std::size_t i, std::size_t n, const auto&... parts) {
+          return simd_for_each_zip_main<ExecutionPolicy, V>(fun, i, n, parts...);
+        },
+        size, seq,
+        simd_zip_part<std::remove_reference_t<std::ranges::range_reference_t<Rs>>,
+                      write_back[Ks]>{std::ranges::data(rngs)}...);
+  }(std::index_sequence_for<Rs...>());
+}
+
+// for_each(policy, r0, r1, ..., fun) calls fun(V0&, V1&, ...) with chunks of equal size loaded
+// in lockstep from all ranges. Chunks are written back to the ranges that fun modifies.
+template <typename ExecutionPolicy, std::ranges::contiguous_range R0,
+          std::ranges::contiguous_range R1, typename... Args>
+  requires execution::is_simd_policy<ExecutionPolicy>::value
+constexpr void for_each(ExecutionPolicy, R0&& r0, R1&& r1, Args&&... args)
+{
+  constexpr std::size_t n_ranges = sizeof...(Args) + 1;
+  auto&& all = std::forward_as_tuple(r0, r1, args...);
+  [&]<std::size_t... Ks>(std::index_sequence<Ks...>) {
+    simd_for_each_zip_ranges<ExecutionPolicy>(std::get<n_ranges>(all), std::get<Ks>(all)...);
+  }(std::make_index_sequence<n_ranges>());
+}
+
+// Reduces the lanes of v with binop, recursively combining the low and high halves.
+template <typename V> constexpr typename V::value_type simd_pairwise_reduce(const V& v, auto&& binop)
+{
+  if constexpr (V::size() == 1) {
+    return v[0];
+  } else {
+    static_assert(std::has_single_bit(V::size()));
+    const auto [lo, hi] = stdx::split<V::size() / 2, V::size() / 2>(v);
+    return simd_pairwise_reduce(std::invoke(binop, lo, hi), binop);
   }
-  simd_for_each_epilogue<V, write_back>(fun, rng, i, flags);
 }
+
+template <bool pairwise, typename V> constexpr auto simd_reduce_lanes(const V& v, auto&& binop)
+{
+  if constexpr (pairwise) {
+    return simd_pairwise_reduce(v, binop);
+  } else {
+    return stdx::reduce(v, binop);
+  }
+}
+
+// Combines the accumulators acc[0] ... acc[N-1] into acc[0].
+template <bool pairwise, typename A, std::size_t N>
+constexpr const A& simd_combine_accumulators(std::array<A, N>& acc, auto&& binop)
+{
+  if constexpr (pairwise) {
+    for (std::size_t stride = 1; stride < N; stride *= 2) {
+      for (std::size_t k = 0; k + stride < N; k += 2 * stride) {
+        acc[k] = std::invoke(binop, acc[k], acc[k + stride]);
+      }
+    }
+  } else {
+    for (std::size_t k = 1; k < N; ++k) {
+      acc[0] = std::invoke(binop, acc[0], acc[k]);
+    }
+  }
+  return acc[0];
+}
+
+template <typename ExecutionPolicy, typename T, typename BinOp, typename Transform, typename... Rs>
+constexpr T simd_transform_reduce_ranges(T init, BinOp& binop, Transform& transform, Rs&... rngs)
+{
+  static_assert(ExecutionPolicy::_threads == 0 and not ExecutionPolicy::_streaming_stores,
+                "transform_reduce does not support parallel and streaming_stores");
+  constexpr bool pairwise = ExecutionPolicy::_pairwise_reduction;
+  constexpr std::size_t N = std::max(ExecutionPolicy::_unroll_by, 1);
+  using R0 = std::tuple_element_t<0, std::tuple<Rs...>>;
+  using V = stdx::native_simd<std::ranges::range_value_t<R0>>;
+  const std::size_t size = std::min({std::size_t(std::ranges::size(rngs))...});
+  T result = init;
+  auto fold_chunks = [&](const auto&... chunks) {
+    result = std::invoke(binop, result,
+                         simd_reduce_lanes<pairwise>(std::invoke(transform, chunks...), binop));
+  };
+  auto main_loop = [&](std::size_t i, std::size_t n, const auto&... parts) {
+    auto transform_at = [&](std::size_t j) {
+      return std::invoke(transform, parts.template load<V>(j)...);
+    };
+    if (i + N * V::size() > n) {
+      for (; i + V::size() <= n; i += V::size()) {
+        simd_invoke_zip<V>(fold_chunks, i, std::make_index_sequence<1>(), parts...);
+      }
+      return i;
+    }
+    // one accumulator per unrolled chunk, initialized from the first N chunks
+    using A = decltype(transform_at(i));
+    auto acc = [&]<std::size_t... Is>(std::index_sequence<Is...>) {
+      return std::array<A, N>{transform_at(i + V::size() * Is)...};
+    }(std::make_index_sequence<N>());
+    for (i += N * V::size(); i + N * V::size() <= n; i += N * V::size()) {
+      if constexpr (ExecutionPolicy::_prefetch_distance > 0) {
+        (simd_prefetch<ExecutionPolicy::_prefetch_distance, false,
+                       sizeof(typename std::remove_cvref_t<decltype(parts)>::template simd_type<V>) *
+                           N>(parts.ptr + i),
+         ...);
+      }
+      [&]<std::size_t... Is>(std::index_sequence<Is...>) {
+        ((acc[Is] = std::invoke(binop, acc[Is], transform_at(i + V::size() * Is))), ...);
+      }(std::make_index_sequence<N>());
+    }
+    for (; i + V::size() <= n; i += V::size()) {
+      acc[0] = std::invoke(binop, acc[0], transform_at(i));
+    }
+    result = std::invoke(binop, result,
+                         simd_reduce_lanes<pairwise>(
+                             simd_combine_accumulators<pairwise>(acc, binop), binop));
+    return i;
+  };
+  [&]<std::size_t... Ks>(std::index_sequence<Ks...> seq) {
+    simd_for_each_zip<ExecutionPolicy::_prefers_aligned and not pairwise, V, 0>(
+        fold_chunks, main_loop, size, seq,
+        simd_zip_part<const std::ranges::range_value_t<Rs>, false>{std::ranges::data(rngs)}...);
+  }(std::index_sequence_for<Rs...>());
+  return result;
+}
+
+// transform_reduce(policy, r0, r1, ..., init, binop, transform) returns the binop-reduction of
+// init and transform(V0, V1, ...) over chunks loaded in lockstep from all ranges. transform
+// returns a simd; binop must accept two simds as well as two scalars. The main loop keeps one
+// accumulator per unrolled chunk to hide the latency of binop.
+template <typename ExecutionPolicy, std::ranges::contiguous_range R0, typename... Args>
+  requires execution::is_simd_policy<ExecutionPolicy>::value and (sizeof...(Args) >= 3)
+constexpr auto transform_reduce(ExecutionPolicy, R0&& r0, Args&&... args)
+{
+  constexpr std::size_t n_ranges = sizeof...(Args) - 2;
+  auto&& all = std::forward_as_tuple(r0, args...);
+  return [&]<std::size_t... Ks>(std::index_sequence<Ks...>) {
+    return simd_transform_reduce_ranges<ExecutionPolicy>(
+        std::get<n_ranges>(all), std::get<n_ranges + 1>(all), std::get<n_ranges + 2>(all),
+        std::get<Ks>(all)...);
+  }(std::make_index_sequence<n_ranges>());
+}
+
+template <typename ExecutionPolicy, std::ranges::contiguous_range R, typename T,
+          typename BinOp = std::plus<>>
+  requires execution::is_simd_policy<ExecutionPolicy>::value
+constexpr T reduce(ExecutionPolicy pol, R&& rng, T init, BinOp binop = {})
+{ return transform_reduce(pol, rng, init, binop, std::identity()); }
+
+// A T on a cache line of its own, so that per-thread partial results do not share lines.
+template <typename T> struct alignas(simd_cache_line_size) simd_padded {
+  T value;
+};
+
+// Adds the true lanes of each of the M masks returned by masks_fn(chunk) to totals. Chunks of
+// type V are counted lane-wise in M accumulators of type V per unrolled chunk; these are
+// flushed into totals before any lane could overflow (or, for floating-point V, stop being
+// exact). The chunks of the prologue and epilogue are counted with popcount.
+template <typename ExecutionPolicy, typename V, std::size_t M>
+void simd_count_masks_serial(auto&& rng, auto& masks_fn, std::array<std::size_t, M>& totals)
+{
+  using T = typename V::value_type;
+  constexpr std::size_t N = std::max(ExecutionPolicy::_unroll_by, 1);
+  constexpr std::size_t max_calls = std::is_floating_point_v<T>
+                                        ? std::size_t(1) << std::numeric_limits<T>::digits
+                                        : std::size_t(std::numeric_limits<T>::max());
+  std::array<std::array<V, M>, N> acc = {};
+  std::size_t calls = 0;
+  auto flush = [&] {
+    for (auto& a : acc) {
+      for (std::size_t j = 0; j < M; ++j) {
+        for (std::size_t l = 0; l < V::size(); ++l) {
+          totals[j] += std::size_t(a[j][l]);
+        }
+        a[j] = T();
+      }
+    }
+    calls = 0;
+  };
+  auto count = [&](const auto&... chunks) {
+    if constexpr ((std::same_as<std::remove_cvref_t<decltype(chunks)>, V> and ...)) {
+      [&]<std::size_t... Ks>(std::index_sequence<Ks...>) {
+        ([&](std::array<V, M>& a, const auto& masks) {
+          for (std::size_t j = 0; j < M; ++j) {
+            where(masks[j], a[j]) += T(1);
+          }
+        }(acc[Ks], masks_fn(chunks)), ...);
+      }(std::index_sequence_for<decltype(chunks)...>());
+      if (++calls == max_calls) {
+        flush();
+      }
+    } else {
+      ([&](const auto& masks) {
+        for (std::size_t j = 0; j < M; ++j) {
+          totals[j] += popcount(masks[j]);
+        }
+      }(masks_fn(chunks)), ...);
+    }
+  };
+  simd_for_each_serial<ExecutionPolicy, V, false>(rng, count);
+  flush();
+}
+
+template <typename ExecutionPolicy, std::size_t M>
+std::array<std::size_t, M> simd_count_masks(auto&& rng, auto& masks_fn)
+{
+  static_assert(not ExecutionPolicy::_masked_epilogue and not ExecutionPolicy::_streaming_stores,
+                "counting does not support masked_epilogue and streaming_stores");
+  using T = std::ranges::range_value_t<decltype(rng)>;
+  using V = stdx::native_simd<T>;
+  const std::span<const T> all(std::ranges::data(rng), std::ranges::size(rng));
+  std::array<std::size_t, M> totals = {};
+  if constexpr (ExecutionPolicy::_threads > 1) {
+    std::vector<simd_padded<std::array<std::size_t, M>>> partials(ExecutionPolicy::_threads);
+    simd_parallel_chunks(all, ExecutionPolicy::_threads,
+                         [&](int worker, std::span<const T> chunk) {
+                           simd_count_masks_serial<ExecutionPolicy, V>(chunk, masks_fn,
+                                                                      partials[worker].value);
+                         });
+    for (const auto& partial : partials) {
+      for (std::size_t j = 0; j < M; ++j) {
+        totals[j] += partial.value[j];
+      }
+    }
+  } else {
+    simd_count_masks_serial<ExecutionPolicy, V>(all, masks_fn, totals);
+  }
+  return totals;
+}
+
+// count_if(policy, rng, pred) returns the number of elements for which pred is true. pred is
+// called with simds (of different sizes, like fun of for_each) and returns their simd_mask.
+// With parallel<N>() every thread counts into its own partial result.
+template <typename ExecutionPolicy, std::ranges::contiguous_range R, typename Pred>
+  requires execution::is_simd_policy<ExecutionPolicy>::value
+std::size_t count_if(ExecutionPolicy, R&& rng, Pred pred)
+{
+  auto masks = [&](const auto& x) { return std::array{pred(x)}; };
+  return simd_count_masks<ExecutionPolicy, 1>(rng, masks)[0];
+}
+
+// histogram(policy, rng, edges) with E ascending edges returns E + 1 counts: bucket 0 counts
+// x < edges[0], bucket k counts edges[k-1] <= x < edges[k], and bucket E counts the remaining
+// elements (including NaNs). Every chunk is compared against all edges, which is branch-free
+// but makes the cost linear in E.
+template <typename ExecutionPolicy, std::ranges::contiguous_range R, std::size_t E>
+  requires execution::is_simd_policy<ExecutionPolicy>::value and (E > 0)
+std::array<std::size_t, E + 1> histogram(ExecutionPolicy,
+                                         R&& rng,
+                                         const std::array<std::ranges::range_value_t<R>, E>& edges)
+{
+  auto masks = [&](const auto& x) {
+    return [&]<std::size_t... Js>(std::index_sequence<Js...>) {
+      return std::array{(x < edges[Js])...};
+    }(std::make_index_sequence<E>());
+  };
+  const auto below = simd_count_masks<ExecutionPolicy, E>(rng, masks);
+  std::array<std::size_t, E + 1> buckets;
+  buckets[0] = below[0];
+  for (std::size_t k = 1; k < E; ++k) {
+    buckets[k] = below[k] - below[k - 1];
+  }
+  buckets[E] = std::ranges::size(rng) - below[E - 1];
+  return buckets;
+}
+
+#endif // SIMD_FOR_EACH_H
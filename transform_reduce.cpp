@@ -14,10 +14,11 @@
 #include <ranges>
 #include <vector>
 
+#include "simd_for_each.h"
+
 namespace stdx = vir::stdx;
 
 constexpr long smallest = 2;
-constexpr long largest = 4 << 20;
 
 template <typename T>
   struct Point
@@ -35,8 +36,7 @@ template <typename T>
 
 using type = Point<float>;
 
-alignas(4096) std::array<char, largest * sizeof(type) * 3> s_buffer;
-std::pmr::monotonic_buffer_resource s_memory {s_buffer.data(), s_buffer.size()};
+mmap_resource s_memory(cache_sweep_max_bytes() * 3);
 
 auto make_data(std::size_t n)
 {
@@ -70,29 +70,41 @@ struct mult
   { return __x * __y; }
 };
 
+// the x, y, z members of all points as one contiguous range of floats
+std::span<const float>
+as_floats(const auto& points)
+{ return {reinterpret_cast<const float*>(points.data()), 3 * points.size()}; }
+
 template <auto pol, Variant var>
   [[gnu::always_inline]]
-  void
-  do_benchmark(benchmark::State& state, auto const& v0, auto const& v1)
+  float
+  do_inner_product(auto const& v0, auto const& v1)
   {
-    if constexpr (not std::is_same_v<decltype(pol), decltype(std::execution::seq)>)
-      vir::fake_read(std::transform_reduce(pol, v0.begin(), v0.end(), v1.begin(), 0.f));
+    if constexpr (execution::is_simd_policy<std::remove_cvref_t<decltype(pol)>>::value)
+      return ::transform_reduce(pol, as_floats(v0), as_floats(v1), 0.f, std::plus<>(),
+                                std::multiplies<>());
+    else if constexpr (not std::is_same_v<decltype(pol), decltype(std::execution::seq)>)
+      return std::transform_reduce(pol, v0.begin(), v0.end(), v1.begin(), 0.f);
     else if constexpr (var == OrderedReduction)
-      vir::fake_read(std::inner_product(v0.begin(), v0.end(), v1.begin(), 0.f));
+      return std::inner_product(v0.begin(), v0.end(), v1.begin(), 0.f);
     else
-      vir::fake_read(std::transform_reduce(v0.begin(), v0.end(), v1.begin(), 0.f));
-    for (auto _ : state)
-      {
-        asm volatile("");
-        if constexpr (not std::is_same_v<decltype(pol), decltype(std::execution::seq)>)
-          vir::fake_read(std::transform_reduce(pol, v0.begin(), v0.end(), v1.begin(), 0.f));
-        else if constexpr (var == OrderedReduction)
-          vir::fake_read(std::inner_product(v0.begin(), v0.end(), v1.begin(), 0.f));
-        else
-          vir::fake_read(std::transform_reduce(v0.begin(), v0.end(), v1.begin(), 0.f));
-        asm volatile("");
-      }
+      return std::transform_reduce(v0.begin(), v0.end(), v1.begin(), 0.f);
+  }
+
+template <auto pol, Variant var>
+  [[gnu::always_inline]]
+  void
+  do_benchmark(benchmark::State& state, auto const& v0, auto const& v1)
+  {
+    robust_measure(state, [&] {
+      asm volatile("");
+      vir::fake_read(do_inner_product<pol, var>(v0, v1));
+      asm volatile("");
+    });
     add_throughput_counters<void>(state);
+    // one multiply-add per float
+    const std::size_t bytes = 2 * v0.size() * sizeof(type);
+    add_roofline_counters(state, bytes, bytes, 2. * v0.size() * sizeof(type) / sizeof(float));
   }
 
 template <auto pol, Variant var = Aligned>
@@ -122,10 +134,8 @@ template <auto pol, Variant var = Aligned>
 static void
 MyRange(benchmark::internal::Benchmark* b)
 {
-  for (long i = smallest; i <= largest; i += i)
-    b->Args({i - 1});
-  for (long i = smallest; i <= largest; i += i)
-    b->Args({i});
+  cache_range<type>(b, smallest);
+  robust_iterations(b);
 }
 
 BENCHMARK(innerproduct<vir::execution::simd>)->Apply(MyRange);
@@ -146,5 +156,15 @@ BENCHMARK(innerproduct<vir::execution::simd.unroll_by<2>()>)->Apply(MyRange);
 //BENCHMARK(innerproduct_O3<std::execution::unseq>)->Apply(MyRange);
 BENCHMARK(innerproduct<std::execution::seq>)->Apply(MyRange);
 //BENCHMARK(innerproduct_O3<std::execution::seq>)->Apply(MyRange);
-//BENCHMARK(innerproduct<std::execution::seq, OrderedReduction>)->Apply(MyRange);
+BENCHMARK(innerproduct<std::execution::seq, OrderedReduction>)->Apply(MyRange);
 //BENCHMARK(innerproduct_O3<std::execution::seq, OrderedReduction>)->Apply(MyRange);
+
+// simd_for_each.h transform_reduce
+BENCHMARK(innerproduct<execution::simd>)->Apply(MyRange);
+BENCHMARK(innerproduct<execution::simd.unroll_by<2>()>)->Apply(MyRange);
+BENCHMARK(innerproduct<execution::simd.unroll_by<4>()>)->Apply(MyRange);
+BENCHMARK(innerproduct<execution::simd.unroll_by<8>()>)->Apply(MyRange);
+BENCHMARK(innerproduct<execution::simd.prefer_aligned().unroll_by<4>()>)->Apply(MyRange);
+BENCHMARK(innerproduct<execution::simd.unroll_by<4>().pairwise_reduction()>)->Apply(MyRange);
+BENCHMARK(innerproduct<execution::simd.unroll_by<4>(), Misaligned>)->Apply(MyRange);
+BENCHMARK(innerproduct<execution::simd.prefer_aligned().unroll_by<4>(), Misaligned>)->Apply(MyRange);